@@ -0,0 +1,348 @@
+#include "arch/tsc.h"
+#include "os/memory.h"
+#include "structs/cht.h"
+#include "structs/index_pool.h"
+#include "structs/map.h"
+#include "structs/timer_wheel.h"
+
+// We already have a time_t, don't re-define it (first for glibc, second for musl)
+#define __time_t_defined 1
+#define __DEFINED_time_t 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Microbenchmarks of the data structures, in-process and without any NIC, to get a baseline before and after data structure changes.
+// Each operation is repeated over enough rounds that at least OPS_TARGET operations are measured, then the average is reported.
+// Keys are random, so accesses to the structures are random, but the keys themselves are read sequentially as a driver would.
+
+#define OPS_TARGET (4u * 1024u * 1024u)
+
+// For the shared memory allocator, as in the OS layers; transparent hugepages are good enough for a benchmark and need no privileges
+char* memory;
+size_t memory_used_len;
+
+static const size_t key_sizes[] = {6, 13, 16};
+static const size_t capacities[] = {1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024};
+static const unsigned load_factors[] = {10, 25, 50, 75, 90, 95};
+static const uint16_t backend_capacities[] = {16, 256, 1024};
+
+// Ensures the compiler does not optimize away results
+static volatile size_t sink;
+
+struct stopwatch {
+	uint64_t ns;
+	uint64_t cycles;
+	uint64_t ops;
+	uint64_t start_ns;
+	uint64_t start_cycles;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void stopwatch_start(struct stopwatch* watch)
+{
+	watch->start_ns = now_ns();
+	watch->start_cycles = tsc_get();
+}
+
+static void stopwatch_stop(struct stopwatch* watch, size_t ops)
+{
+	watch->cycles += tsc_get() - watch->start_cycles;
+	watch->ns += now_ns() - watch->start_ns;
+	watch->ops += ops;
+}
+
+static void report(const char* op, size_t capacity, size_t key_size, unsigned load_factor, struct stopwatch* watch)
+{
+	printf("%-14s %8zu %4zu %5u%% %10.2f %10.2f\n", op, capacity, key_size, load_factor, (double) watch->ns / (double) watch->ops,
+	       (double) watch->cycles / (double) watch->ops);
+	*watch = (struct stopwatch){0};
+}
+
+static void memory_reset(void)
+{
+	// The allocator expects unused memory to be zeroed
+	memset(memory, 0, memory_used_len);
+	memory_used_len = 0;
+}
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+static uint64_t random_next(void)
+{
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return random_state * 0x2545F4914F6CDD1Dull;
+}
+
+static char* keys_alloc(size_t count, size_t key_size)
+{
+	char* keys = malloc(count * key_size);
+	if (keys == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (size_t n = 0; n < count * key_size; n++) {
+		keys[n] = (char) random_next();
+	}
+	return keys;
+}
+
+static size_t rounds_for(size_t ops)
+{
+	return ops >= OPS_TARGET ? 1 : (OPS_TARGET + ops - 1) / ops;
+}
+
+static void bench_map(size_t capacity, size_t key_size, unsigned load_factor)
+{
+	size_t count = capacity * load_factor / 100;
+	char* keys = keys_alloc(count, key_size);
+	char* missing_keys = keys_alloc(count, key_size);
+	// Lookups use copies of the keys, as NFs look up keys from packets while the map refers to the NF's own copy
+	char* lookup_keys = keys_alloc(count, key_size);
+	memcpy(lookup_keys, keys, count * key_size);
+	struct map* map = map_alloc(key_size, capacity);
+
+	struct stopwatch set = {0};
+	struct stopwatch get_hit = {0};
+	struct stopwatch get_miss = {0};
+	struct stopwatch remove = {0};
+	size_t value;
+	size_t rounds = rounds_for(count);
+	for (size_t r = 0; r < rounds; r++) {
+		stopwatch_start(&set);
+		for (size_t n = 0; n < count; n++) {
+			map_set(map, keys + n * key_size, n);
+		}
+		stopwatch_stop(&set, count);
+
+		stopwatch_start(&get_hit);
+		for (size_t n = 0; n < count; n++) {
+			sink = map_get(map, lookup_keys + n * key_size, &value);
+		}
+		stopwatch_stop(&get_hit, count);
+
+		stopwatch_start(&get_miss);
+		for (size_t n = 0; n < count; n++) {
+			sink = map_get(map, missing_keys + n * key_size, &value);
+		}
+		stopwatch_stop(&get_miss, count);
+
+		stopwatch_start(&remove);
+		for (size_t n = 0; n < count; n++) {
+			map_remove(map, keys + n * key_size);
+		}
+		stopwatch_stop(&remove, count);
+	}
+
+	report("map set", capacity, key_size, load_factor, &set);
+	report("map get hit", capacity, key_size, load_factor, &get_hit);
+	report("map get miss", capacity, key_size, load_factor, &get_miss);
+	report("map remove", capacity, key_size, load_factor, &remove);
+
+	free(keys);
+	free(missing_keys);
+	free(lookup_keys);
+	memory_reset();
+}
+
+static void bench_index_pool(size_t capacity, unsigned load_factor)
+{
+	const time_t expiration_time = 1000;
+	size_t count = capacity * load_factor / 100;
+	size_t* indices = malloc(count * sizeof(size_t));
+	size_t* refreshed = malloc(count * sizeof(size_t));
+	if (indices == NULL || refreshed == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	struct index_pool* pool = index_pool_alloc(capacity, expiration_time);
+
+	struct stopwatch borrow = {0};
+	struct stopwatch refresh = {0};
+	struct stopwatch churn = {0};
+	bool used;
+	size_t rounds = rounds_for(count);
+	time_t time = 1;
+	for (size_t r = 0; r < rounds; r++) {
+		stopwatch_start(&borrow);
+		for (size_t n = 0; n < count; n++) {
+			index_pool_borrow(pool, time, &(indices[n]), &used);
+		}
+		stopwatch_stop(&borrow, count);
+
+		for (size_t n = 0; n < count; n++) {
+			refreshed[n] = indices[random_next() % count];
+		}
+		time = time + 1;
+		stopwatch_start(&refresh);
+		for (size_t n = 0; n < count; n++) {
+			index_pool_refresh(pool, time, refreshed[n]);
+		}
+		stopwatch_stop(&refresh, count);
+
+		// All indices are now expired, so each borrow reclaims one
+		time = time + expiration_time + 1;
+		stopwatch_start(&churn);
+		for (size_t n = 0; n < count; n++) {
+			index_pool_borrow(pool, time, &(indices[n]), &used);
+		}
+		stopwatch_stop(&churn, count);
+
+		for (size_t n = 0; n < count; n++) {
+			index_pool_return(pool, indices[n]);
+		}
+		time = time + 1;
+	}
+
+	report("pool borrow", capacity, 0, load_factor, &borrow);
+	report("pool refresh", capacity, 0, load_factor, &refresh);
+	report("pool churn", capacity, 0, load_factor, &churn);
+
+	free(indices);
+	free(refreshed);
+	memory_reset();
+}
+
+static void bench_timer_wheel(size_t capacity, unsigned load_factor)
+{
+	// Flows expire within a minute, at millisecond granularity
+	const time_t granularity = 1000000;
+	const time_t window = 60000000000ull;
+	size_t count = capacity * load_factor / 100;
+	time_t* expirations = malloc(count * sizeof(time_t));
+	if (expirations == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	struct timer_wheel* wheel = timer_wheel_alloc(capacity, granularity);
+
+	struct stopwatch schedule = {0};
+	struct stopwatch pop = {0};
+	size_t index;
+	size_t rounds = rounds_for(count);
+	time_t time = window;
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t n = 0; n < count; n++) {
+			expirations[n] = time + random_next() % window;
+		}
+		stopwatch_start(&schedule);
+		for (size_t n = 0; n < count; n++) {
+			timer_wheel_schedule(wheel, n, expirations[n]);
+		}
+		stopwatch_stop(&schedule, count);
+
+		// Time moves forward as packets arrive, popping one timer per "packet" as an NF would
+		time = time + window + granularity;
+		stopwatch_start(&pop);
+		for (size_t n = 0; n < count; n++) {
+			sink = timer_wheel_pop_expired(wheel, time - window + n * (window / count), &index);
+		}
+		while (timer_wheel_pop_expired(wheel, time, &index)) {
+		}
+		stopwatch_stop(&pop, count);
+	}
+	report("wheel schedule", capacity, 0, load_factor, &schedule);
+	report("wheel pop", capacity, 0, load_factor, &pop);
+
+	free(expirations);
+	memory_reset();
+}
+
+static uint16_t prime_above(uint16_t value)
+{
+	for (uint16_t candidate = value + 1;; candidate++) {
+		bool prime = true;
+		for (uint16_t d = 2; d * d <= candidate; d++) {
+			if (candidate % d == 0) {
+				prime = false;
+				break;
+			}
+		}
+		if (prime) {
+			return candidate;
+		}
+	}
+}
+
+static void bench_cht(uint16_t backend_capacity, size_t key_size, unsigned load_factor)
+{
+	// Maglev recommends a table at least 100 times larger than the number of backends, within our height limit
+	uint16_t height = prime_above(backend_capacity * 100 < MAX_CHT_HEIGHT ? (uint16_t) (backend_capacity * 100) : (uint16_t) (MAX_CHT_HEIGHT - 1000));
+	struct cht* cht = cht_alloc(height, backend_capacity);
+	struct index_pool* backends = index_pool_alloc(backend_capacity, 1000);
+	// Active backends are random, as they would be after churn
+	size_t active_count = backend_capacity * load_factor / 100;
+	size_t index;
+	bool used;
+	for (size_t n = 0; n < active_count; n++) {
+		index_pool_borrow(backends, 1, &index, &used);
+	}
+	for (size_t n = 0; n < backend_capacity / 2; n++) {
+		size_t a = random_next() % backend_capacity;
+		if (index_pool_used(backends, 1, a)) {
+			index_pool_return(backends, a);
+			index_pool_borrow(backends, 1, &index, &used);
+		}
+	}
+
+	// As an NF would after the backends settle, see cht_rebuild
+	cht_request_rebuild(cht);
+	cht_rebuild(cht, backends, 1, height);
+
+	size_t count = 64 * 1024;
+	char* keys = keys_alloc(count, key_size);
+	struct stopwatch lookup = {0};
+	uint16_t backend;
+	size_t rounds = rounds_for(count);
+	for (size_t r = 0; r < rounds; r++) {
+		stopwatch_start(&lookup);
+		for (size_t n = 0; n < count; n++) {
+			sink = cht_find_preferred_available_backend(cht, keys + n * key_size, key_size, backends, &backend, 1);
+		}
+		stopwatch_stop(&lookup, count);
+	}
+	report("cht lookup", backend_capacity, key_size, load_factor, &lookup);
+
+	free(keys);
+	memory_reset();
+}
+
+int main(void)
+{
+	memory = mmap(NULL, OS_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (memory == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return 1;
+	}
+	madvise(memory, OS_MEMORY_SIZE, MADV_HUGEPAGE);
+	memory_used_len = 0;
+
+	printf("%-14s %8s %4s %6s %10s %10s\n", "operation", "capacity", "key", "load", "ns/op", "cycles/op");
+	for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+		for (size_t l = 0; l < sizeof(load_factors) / sizeof(load_factors[0]); l++) {
+			for (size_t k = 0; k < sizeof(key_sizes) / sizeof(key_sizes[0]); k++) {
+				bench_map(capacities[c], key_sizes[k], load_factors[l]);
+			}
+			bench_index_pool(capacities[c], load_factors[l]);
+			bench_timer_wheel(capacities[c], load_factors[l]);
+		}
+	}
+	for (size_t b = 0; b < sizeof(backend_capacities) / sizeof(backend_capacities[0]); b++) {
+		for (size_t l = 0; l < sizeof(load_factors) / sizeof(load_factors[0]); l++) {
+			for (size_t k = 0; k < sizeof(key_sizes) / sizeof(key_sizes[0]); k++) {
+				bench_cht(backend_capacities[b], key_sizes[k], load_factors[l]);
+			}
+		}
+	}
+	return 0;
+}
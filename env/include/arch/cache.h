@@ -3,3 +3,17 @@
 // Table 11-1 from Volume 3A of the Intel manuals
 // 64 bytes for all CPUs we care about, i.e., Xeon and i3/i5/i7
 #define CACHE_LINE_SIZE 64
+
+// Hints to the CPU that the cache line containing the given address will soon be read, so that it can start fetching it
+// This has no observable effect, in particular the address need not be valid
+static inline void cache_prefetch(const void* addr)
+//@ requires true;
+//@ ensures true;
+//@ terminates;
+{
+#ifdef VERIFAST
+	(void) addr;
+#else
+	__builtin_prefetch(addr);
+#endif
+}
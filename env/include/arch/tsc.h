@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cpuid.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 static inline uint64_t tsc_get(void)
@@ -8,17 +10,94 @@ static inline uint64_t tsc_get(void)
 	return __builtin_ia32_rdtsc();
 }
 
-// Gets the frequency of the timestamp counter in nanohertz as a rational number, given an MSR-reading function
-static inline void tsc_get_nhz(uint64_t (*read_msr)(uint64_t), uint64_t* out_numerator, uint64_t* out_denominator)
+// Gets the frequency of the timestamp counter in nanohertz as a rational number from CPUID, which Intel CPUs support since Skylake
+static inline bool tsc_get_cpuid_nhz(uint64_t* out_numerator, uint64_t* out_denominator)
 {
-	// We're on Ivy Bridge
-	// TODO make this more general? or just fail if not SB/IB/HW/BW given the cite below?
+	unsigned max_leaf = __get_cpuid_max(0, 0);
+	unsigned eax;
+	unsigned ebx;
+	unsigned ecx;
+	unsigned edx;
+
+	// Intel manual Volume 2A, CPUID, leaf 15H: "EAX Bits 31-00: An unsigned integer which is the denominator of the TSC/"core crystal clock" ratio.
+	//                                           EBX Bits 31-00: An unsigned integer which is the numerator of the TSC/"core crystal clock" ratio.
+	//                                           ECX Bits 31-00: An unsigned integer which is the nominal frequency of the core crystal clock in Hz."
+	// Any of these may be 0 if not enumerated, in particular the crystal frequency on many server CPUs, in which case leaf 16H is the next best thing
+	if (max_leaf >= 0x15) {
+		__cpuid(0x15, eax, ebx, ecx, edx);
+		if (eax != 0 && ebx != 0 && ecx != 0) {
+			*out_numerator = (uint64_t) ecx * ebx;
+			*out_denominator = (uint64_t) eax * 1000000000ull;
+			return true;
+		}
+	}
+
+	// Intel manual Volume 2A, CPUID, leaf 16H: "EAX Bits 15-00: Processor Base Frequency (in MHz)."
+	// The TSC runs at the base frequency, modulo the crystal's accuracy, which is as good as the MSR below
+	if (max_leaf >= 0x16) {
+		__cpuid(0x16, eax, ebx, ecx, edx);
+		if ((eax & 0xFFFF) != 0) {
+			*out_numerator = eax & 0xFFFF;
+			*out_denominator = 1000;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Gets the frequency of the timestamp counter in nanohertz as a rational number from MSR_PLATFORM_INFO, given a function that tries to read an MSR
+static inline bool tsc_get_msr_nhz(bool (*try_read_msr)(uint64_t, uint64_t*), uint64_t* out_numerator, uint64_t* out_denominator)
+{
+	// Only Intel CPUs have this MSR, reading it elsewhere faults
+	unsigned eax;
+	unsigned ebx;
+	unsigned ecx;
+	unsigned edx;
+	__cpuid(0, eax, ebx, ecx, edx);
+	// "GenuineIntel", in little-endian order in EBX, EDX, ECX
+	if (ebx != 0x756E6547 || edx != 0x49656E69 || ecx != 0x6C65746E) {
+		return false;
+	}
 
 	// Intel manual Volume 3B:
 	// "18.7.3.1 For Intel® Processors Based on Microarchitecture Code Name Sandy Bridge, Ivy Bridge, Haswell and Broadwell:
 	//  The scalable bus frequency is encoded in the bit field MSR_PLATFORM_INFO[15:8] and the nominal TSC frequency can be determined by multiplying this number by a bus speed of 100 MHz."
+	// Later CPUs also have a 100 MHz bus, but should have been handled by CPUID already.
 	// MSR_PLATFORM_INFO is 0xCE
-	uint64_t msr = read_msr(0xCE);
+	uint64_t msr;
+	if (!try_read_msr(0xCE, &msr)) {
+		return false;
+	}
 	*out_numerator = (msr >> 8) & 0xFF;
 	*out_denominator = 10;
+	return *out_numerator != 0;
+}
+
+// Gets the frequency of the timestamp counter in nanohertz as a rational number, from CPUID if possible, otherwise from an MSR.
+// Returns false if neither works, e.g., in some virtual machines, in which case the OS must measure the frequency itself.
+static inline bool tsc_get_nhz(bool (*try_read_msr)(uint64_t, uint64_t*), uint64_t* out_numerator, uint64_t* out_denominator)
+{
+	return tsc_get_cpuid_nhz(out_numerator, out_denominator) || tsc_get_msr_nhz(try_read_msr, out_numerator, out_denominator);
+}
+
+// Converts a TSC frequency in ticks per nanosecond, given as a rational number, into a fixed-point conversion:
+// nanoseconds = (ticks * multiplier) >> shift, using the largest shift that keeps the multiplier within 64 bits, for precision
+static inline void tsc_get_ns_conversion(uint64_t numerator, uint64_t denominator, uint64_t* out_multiplier, uint64_t* out_shift)
+{
+	// Binary long division, one bit at a time, since 128-bit division needs a runtime library we may not have
+	uint64_t quotient = denominator / numerator;
+	uint64_t remainder = denominator % numerator;
+	uint64_t shift = 0;
+	while (shift < 64 && (quotient >> 63) == 0) {
+		remainder = remainder * 2;
+		quotient = quotient * 2;
+		if (remainder >= numerator) {
+			remainder = remainder - numerator;
+			quotient = quotient + 1;
+		}
+		shift = shift + 1;
+	}
+	*out_multiplier = quotient;
+	*out_shift = shift;
 }
@@ -5,9 +5,10 @@
 #include "os/config.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-// Network functions have two mandatory methods and can read from a config file
+// Network functions have two mandatory methods, one optional method, and can read from a config file
 // The config file must be in the following format:
 //   {"[key name]", [value: must be an integer]}
 // Multiple entries like the above can be added but must be separated by a comma
@@ -26,6 +27,32 @@ void nf_handle(struct net_packet* packet);
 //@ requires *packet |-> _;
 //@ ensures *packet |-> _;
 
+// Optionally, handles the given packets, of which there is at least one, which must have the same effect as calling nf_handle on each of them in order
+// This allows NFs to amortize work across packets, e.g., to prefetch the state needed by all packets before handling any of them
+// Note that verification only considers nf_handle, which must thus still be defined
+// No memory allocation can be performed in this function
+void nf_handle_batch(struct net_packet* packets, size_t count) __attribute__((weak));
+//@ requires packets[0..count] |-> _;
+//@ ensures packets[0..count] |-> _;
+
+// Optionally, declares that the NF keeps either no state, or only state for each TCP/UDP flow that it finds using the flow's addresses and ports in either direction, by being defined as true.
+// Drivers can then run a separate copy of the NF on each core, since symmetric RSS sends both directions of a flow to the same core.
+// NFs whose state is shared by flows must not define this, e.g., NATs, whose return traffic is addressed to ports they choose, or load balancers, which track backends;
+// drivers refuse to run them on more than one core.
+extern const bool nf_per_flow_state __attribute__((weak));
+
+// For drivers: hands the given packets to the NF, using nf_handle_batch if the NF defines it and calling nf_handle on each packet otherwise
+static inline void net_handle_batch(struct net_packet* packets, size_t count)
+{
+	if (nf_handle_batch != NULL) {
+		nf_handle_batch(packets, count);
+	} else {
+		for (size_t n = 0; n < count; n++) {
+			nf_handle(&(packets[n]));
+		}
+	}
+}
+
 // Convenience method to read a device from the config file, given the number of existing devices
 static inline bool os_config_get_device(const char* name, device_t devices_count, device_t* out_value)
 {
@@ -6,12 +6,14 @@
 #include <stdint.h>
 
 // Fetched at startup by the OS, to make the time call as fast as possible, it's on the critical path
-extern uint64_t cpu_freq_numerator;
-extern uint64_t cpu_freq_denominator;
+// The time in nanoseconds is (TSC * multiplier) >> shift, which needs neither a division nor a loss of precision; see tsc_get_ns_conversion
+extern uint64_t cpu_freq_multiplier;
+extern uint64_t cpu_freq_shift;
 
 // Gets the current time in nanoseconds, according to a monotonic clock with an undefined starting point.
 // It's a safe assumption that this never returns TIME_MAX, allowing containers that store a time to optimize storage; anyway, reaching the end of time would be problematic
-static inline time_t os_clock_time_ns(void) { return tsc_get() / cpu_freq_numerator * cpu_freq_denominator; }
+// Drivers should call this once per batch of packets rather than once per packet, since even an rdtsc is not free
+static inline time_t os_clock_time_ns(void) { return (time_t) ((__extension__(unsigned __int128) tsc_get() * cpu_freq_multiplier) >> cpu_freq_shift); }
 
 // Sleeps for at least the given amount of nanoseconds.
 // TODO This function would not be necessary if symbex could handle loops;
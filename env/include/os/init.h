@@ -1,4 +1,11 @@
 #pragma once
 
+#include <stddef.h>
+
 // Initializes the OS. Should only be called once, and only needs to be called by drivers at the start of the main function.
 void os_init(void);
+
+// Runs the rest of the program on the given number of cores, as if each of them had called this function, and returns the index of the current core, between 0 and count - 1.
+// Each core is pinned and has its own copy of global variables; memory allocated before this call is shared by all cores, memory allocated afterwards is private to each core.
+// Should only be called once, after os_init, and only needs to be called by drivers that support multiple cores.
+size_t os_init_cores(size_t count);
@@ -15,8 +15,10 @@
 #define restrict
 #endif
 
-// Amount of memory available to the program, in bytes (256 MB)
+// Maximum amount of memory available to the program, in bytes (256 MB unless overridden at build time); on OSes with multiple cores, each core may have this amount
+#ifndef OS_MEMORY_SIZE
 #define OS_MEMORY_SIZE (256ull * 1024ull * 1024ull)
+#endif
 
 // Type of hashes (a larger hash type than this is generally not useful for data structure purposes)
 typedef unsigned hash_t;
@@ -24,6 +26,7 @@ typedef unsigned hash_t;
 // Allocates a pinned, zero-initialized, contiguous memory block of the given length (size * count), aligned to the length rounded up to the cache line size.
 // "Pinned" here means "the virtual-to-physical mapping will never change", not just that it will always be in memory.
 // This allows the allocated memory's physical address to be given to a device for DMA.
+// However, memory is only physically contiguous within a page, which is at least 4 KB and aligned to its size; objects given to devices must not cross page boundaries.
 // For simplicity, never fails; if there is not enough memory available, crashes the program.
 void* os_memory_alloc(size_t count, size_t size);
 //@ requires count * size <= SIZE_MAX;
@@ -31,6 +34,38 @@ void* os_memory_alloc(size_t count, size_t size);
 	    result != NULL &*& (size_t) result % (size + CACHE_LINE_SIZE - (size % CACHE_LINE_SIZE)) == 0; @*/
 //@ terminates;
 
+// Scratch memory, for buffers that are only needed during part of the initialization, e.g., to compute the contents of a data structure.
+// Scratch memory is allocated within a scope, at the end of which it is all released, and can then be allocated again by os_memory_alloc.
+// The scope predicate tracks what was allocated within it, and the end of the scope requires all of it back, so it cannot be used afterwards.
+// Scopes cannot be nested, and there must not be any os_memory_alloc calls within a scope, since their memory may be released as well; both crash the program.
+/*@
+predicate os_memory_scratch_scope(list<pair<void*, size_t> > allocs);
+
+predicate os_memory_scratch_chars(list<pair<void*, size_t> > allocs) =
+	switch (allocs) {
+		case nil: return emp;
+		case cons(h, t): return chars((char*) fst(h), snd(h), _) &*& os_memory_scratch_chars(t);
+	};
+@*/
+void os_memory_scratch_begin(void);
+//@ requires emp;
+//@ ensures os_memory_scratch_scope(nil);
+//@ terminates;
+
+// Same as os_memory_alloc, but for scratch memory; must be called within a scope.
+void* os_memory_scratch_alloc(size_t count, size_t size);
+//@ requires os_memory_scratch_scope(?allocs) &*& count * size <= SIZE_MAX;
+/*@ ensures os_memory_scratch_scope(cons(pair(result, count * size), allocs)) &*&
+	    chars(result, count * size, ?cs) &*& true == all_eq(cs, 0) &*& result + count * size <= (char*) UINTPTR_MAX &*&
+	    result != NULL &*& (size_t) result % (size + CACHE_LINE_SIZE - (size % CACHE_LINE_SIZE)) == 0; @*/
+//@ terminates;
+
+// Ends the current scope, releasing all scratch memory allocated within it.
+void os_memory_scratch_end(void);
+//@ requires os_memory_scratch_scope(?allocs) &*& os_memory_scratch_chars(allocs);
+//@ ensures emp;
+//@ terminates;
+
 // Maps the region of physical address memory defined by (address, size) into virtual memory.
 void* os_memory_phys_to_virt(uintptr_t addr, size_t size);
 //@ requires emp;
@@ -43,6 +78,36 @@ uintptr_t os_memory_virt_to_phys(const void* addr);
 //@ ensures emp;
 //@ terminates;
 
+#ifndef VERIFAST
+// Compares 'a' and 'b' as two possibly overlapping words of 'word_size' bytes, the first and the last; requires word_size <= obj_size <= 2 * word_size, and word_size to be 4 or 8.
+// Always inlined so that with a constant size, as in the callers' fast paths, this becomes a few loads and no branch.
+static inline __attribute__((always_inline)) bool os_memory_eq_words(const char* a, const char* b, size_t obj_size, size_t word_size)
+{
+	uint64_t a_first = 0;
+	uint64_t b_first = 0;
+	uint64_t a_last = 0;
+	uint64_t b_last = 0;
+	// With 4-byte words, the other half of each variable stays zero and thus compares equal
+	__builtin_memcpy(&a_first, a, word_size);
+	__builtin_memcpy(&b_first, b, word_size);
+	__builtin_memcpy(&a_last, a + obj_size - word_size, word_size);
+	__builtin_memcpy(&b_last, b + obj_size - word_size, word_size);
+	return ((a_first ^ b_first) | (a_last ^ b_last)) == 0;
+}
+
+// Copies 'src' to 'dst' as two possibly overlapping words, with the same requirements as os_memory_eq_words.
+// Both words are loaded before either is stored, which is fine since the two objects cannot overlap.
+static inline __attribute__((always_inline)) void os_memory_copy_words(const char* restrict src, char* restrict dst, size_t obj_size, size_t word_size)
+{
+	uint64_t first = 0;
+	uint64_t last = 0;
+	__builtin_memcpy(&first, src, word_size);
+	__builtin_memcpy(&last, src + obj_size - word_size, word_size);
+	__builtin_memcpy(dst, &first, word_size);
+	__builtin_memcpy(dst + obj_size - word_size, &last, word_size);
+}
+#endif
+
 // Checks if two pointers have equal memory values for the given length
 static inline bool os_memory_eq(const void* a, const void* b, size_t obj_size)
 //@ requires [?f1]chars(a, obj_size, ?acs) &*& [?f2]chars(b, obj_size, ?bcs);
@@ -51,6 +116,24 @@ static inline bool os_memory_eq(const void* a, const void* b, size_t obj_size)
 {
 	const char* ac = (const char*) a;
 	const char* bc = (const char*) b;
+#ifndef VERIFAST
+	// Common key sizes get straight-line code comparing words instead of bytes: MAC addresses, IPv4 address pairs, and flows with or without their padding.
+	// VeriFast only sees the loop below, which these fast paths must agree with.
+	switch (obj_size) {
+		case 6:
+			return os_memory_eq_words(ac, bc, 6, 4);
+		case 8:
+			return os_memory_eq_words(ac, bc, 8, 8);
+		case 12:
+			return os_memory_eq_words(ac, bc, 12, 8);
+		case 13:
+			return os_memory_eq_words(ac, bc, 13, 8);
+		case 16:
+			return os_memory_eq_words(ac, bc, 16, 8);
+		default:
+			break;
+	}
+#endif
 	for (size_t n = 0; n < obj_size; n++)
 	/*@ invariant 0 <= n &*& n <= obj_size &*&
 								[f1]chars(ac, obj_size, acs) &*&
@@ -68,6 +151,40 @@ static inline bool os_memory_eq(const void* a, const void* b, size_t obj_size)
 }
 
 //@ fixpoint hash_t hash_fp(list<char> value);
+
+// Mixes a chunk of up to 8 bytes into a hash state, with the SSE4.2 CRC32C instruction if available, or with multiply-shift hashing otherwise
+static inline uint64_t os_memory_hash_mix(uint64_t state, uint64_t chunk)
+//@ requires true;
+//@ ensures true;
+//@ terminates;
+{
+	// Assume this is correct, since VeriFast, which does not define __SSE4_2__ and thus sees the multiplication, doesn't support treating unsigned overflow as well-defined, as in os_memory_hash below
+	//@ assume(false);
+#ifdef __SSE4_2__
+	return __builtin_ia32_crc32di(state, chunk);
+#else
+	// Odd 64-bit constant from Knuth's multiplicative hashing (2^64 divided by the golden ratio); the result is in the high bits
+	return (state ^ chunk) * 0x9E3779B97F4A7C15ull;
+#endif
+}
+
+// Computes the final hash from a hash state
+static inline hash_t os_memory_hash_final(uint64_t state)
+//@ requires true;
+//@ ensures true;
+//@ terminates;
+{
+	// Assume this is correct, since VeriFast would otherwise require proving that the truncation does not lose bits, which it does on purpose
+	//@ assume(false);
+#ifdef __SSE4_2__
+	// CRC32C only uses the low 32 bits
+	return (hash_t) state;
+#else
+	// Multiply-shift hashing only mixes the input into the high bits
+	return (hash_t) (state >> 32);
+#endif
+}
+
 // Computes the hash of a memory value over the given length
 static inline hash_t os_memory_hash(const void* obj, size_t obj_size)
 //@ requires [?f]chars(obj, obj_size, ?value);
@@ -77,53 +194,55 @@ static inline hash_t os_memory_hash(const void* obj, size_t obj_size)
 	// Assume the hashing function is correct, because VeriFast doesn't support treating unsigned overflow as well-defined (without also losing checks for signed overflow).
 	// Anyway, this function is obviously pure, it cannot modify its input due to the 'const' modifier, and it is run frequently enough that any crashes would be obvious.
 	//@ assume(false);
-	// Still, there's a leftover beginning of proof below.
-	// Without these two VeriFast loses track of the original obj and obj_size
-	//@ void* old_obj = obj;
-	//@ size_t old_obj_size = obj_size;
-
-	//@ size_t discarded_size = 0;
-	hash_t hash = 0;
-	while (obj_size >= sizeof(unsigned))
-	/*@ invariant [f]chars(obj - discarded_size, discarded_size, _) &*&
-								[f]chars(obj, obj_size, _) &*&
-								old_obj == obj - discarded_size &*&
-								old_obj_size == obj_size + discarded_size; @*/
-	{
-		//@ chars_limits(obj);
-		//@ chars_split(obj, 4);
-		//@ chars_to_integer_(obj, 4, false);
-		unsigned value;
-		__builtin_memcpy(&value, obj, sizeof(unsigned));
-		hash = (hash >> 5) + hash + value;
-		//@ integer__to_chars(obj, 4, false);
-		//@ discarded_size += 4;
-		obj = (const unsigned*) obj + 1;
-		obj_size -= sizeof(unsigned);
+
+	const char* bytes = (const char*) obj;
+	uint64_t state = 0;
+	uint64_t chunk8;
+	uint32_t chunk4;
+	uint16_t chunk2;
+	uint8_t chunk1;
+	// Common key sizes get straight-line code: MAC addresses, and flows with or without their padding
+	switch (obj_size) {
+		case 6:
+			__builtin_memcpy(&chunk4, bytes, 4);
+			__builtin_memcpy(&chunk2, bytes + 4, 2);
+			return os_memory_hash_final(os_memory_hash_mix(state, (uint64_t) chunk4 | ((uint64_t) chunk2 << 32)));
+		case 13:
+			__builtin_memcpy(&chunk8, bytes, 8);
+			__builtin_memcpy(&chunk4, bytes + 8, 4);
+			__builtin_memcpy(&chunk1, bytes + 12, 1);
+			state = os_memory_hash_mix(state, chunk8);
+			return os_memory_hash_final(os_memory_hash_mix(state, (uint64_t) chunk4 | ((uint64_t) chunk1 << 32)));
+		case 16:
+			__builtin_memcpy(&chunk8, bytes, 8);
+			state = os_memory_hash_mix(state, chunk8);
+			__builtin_memcpy(&chunk8, bytes + 8, 8);
+			return os_memory_hash_final(os_memory_hash_mix(state, chunk8));
+		default:
+			break;
+	}
+
+	while (obj_size >= 8) {
+		__builtin_memcpy(&chunk8, bytes, 8);
+		state = os_memory_hash_mix(state, chunk8);
+		bytes += 8;
+		obj_size -= 8;
+	}
+	if ((obj_size & 4) != 0) {
+		__builtin_memcpy(&chunk4, bytes, 4);
+		state = os_memory_hash_mix(state, chunk4);
+		bytes += 4;
 	}
-	if ((obj_size & sizeof(unsigned short)) != 0) {
-		//@ chars_limits(obj);
-		//@ chars_split(obj, 2);
-		//@ chars_to_integer_(obj, 2, false);
-		unsigned short value;
-		__builtin_memcpy(&value, obj, sizeof(unsigned short));
-		hash = (hash >> 5) + hash + value;
-		//@ integer__to_chars(obj, 2, false);
-		//@ discarded_size += 2;
-		obj = (const unsigned short*) obj + 1;
-		//@ chars_join(obj - discarded_size);
+	if ((obj_size & 2) != 0) {
+		__builtin_memcpy(&chunk2, bytes, 2);
+		state = os_memory_hash_mix(state, chunk2);
+		bytes += 2;
 	}
-	if ((obj_size & sizeof(unsigned char)) != 0) {
-		//@ chars_split(obj, 1);
-		//@ chars_to_integer_(obj, 1, false);
-		unsigned char value;
-		__builtin_memcpy(&value, obj, sizeof(unsigned char));
-		hash = (hash >> 5) + hash + value;
-		//@ integer__to_chars(obj, 1, false);
-		//@ discarded_size += 1;
-		//@ chars_join(obj + 1 - discarded_size);
+	if ((obj_size & 1) != 0) {
+		__builtin_memcpy(&chunk1, bytes, 1);
+		state = os_memory_hash_mix(state, chunk1);
 	}
-	return hash;
+	return os_memory_hash_final(state);
 }
 
 // Copies the memory content from one pointer to the other over the given length
@@ -135,6 +254,28 @@ static inline void os_memory_copy(const void* restrict src, void* restrict dst,
 	// This proof is essentially a copy of the memcpy one from VeriFast's tutorial.
 	const char* restrict srcc = (const char* restrict) src;
 	char* restrict dstc = (char* restrict) dst;
+#ifndef VERIFAST
+	// Same fast paths as os_memory_eq
+	switch (obj_size) {
+		case 6:
+			os_memory_copy_words(srcc, dstc, 6, 4);
+			return;
+		case 8:
+			os_memory_copy_words(srcc, dstc, 8, 8);
+			return;
+		case 12:
+			os_memory_copy_words(srcc, dstc, 12, 8);
+			return;
+		case 13:
+			os_memory_copy_words(srcc, dstc, 13, 8);
+			return;
+		case 16:
+			os_memory_copy_words(srcc, dstc, 16, 8);
+			return;
+		default:
+			break;
+	}
+#endif
 	for (size_t n = 0;; n++)
 	//@ requires [f]srcc[n..obj_size] |-> ?srccs2 &*& dstc[n..obj_size] |-> _;
 	//@ ensures [f]srcc[old_n..obj_size] |-> srccs2 &*& dstc[old_n..obj_size] |-> srccs2;
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Packet counters, unlike os_debug available in production builds, so that operators can see how many packets went through each device and why NFs dropped packets.
+// Each core has its own counters, in their own cache lines, so that counting needs neither atomics nor cache line transfers between cores.
+// The OS exports all counters as a struct os_stats, on Linux and DPDK in the shared memory object OS_STATS_SHM_NAME (i.e., /dev/shm/klint-stats),
+// which external tools can map read-only and poll, summing the counters of all cores; readers may see slightly stale values, but never torn ones.
+// Klint models all of these functions as doing nothing, thus statistics have no effect on verification.
+
+#define OS_STATS_SHM_NAME "/klint-stats"
+
+#define OS_STATS_CORES_MAX 64
+#define OS_STATS_DEVICES_MAX 32
+#define OS_STATS_DROP_REASONS_MAX 16
+
+// Latencies are counted in logarithmic buckets, as in HdrHistogram: each power of 2 is split in 2^OS_STATS_LATENCY_PRECISION buckets of equal width,
+// i.e., buckets are at most 1/8 as wide as the values they contain, and values below 8 have their own buckets. The last bucket also counts all larger values.
+#define OS_STATS_LATENCY_PRECISION 3
+#define OS_STATS_LATENCY_BUCKETS 256
+
+// Why an NF dropped a packet; reasons are shared by all NFs, so that readers do not need to know which NF is running
+enum os_stats_drop_reason {
+	// The packet is not of a protocol the NF handles, e.g., not TCP/UDP over IPv4 over Ethernet
+	OS_STATS_DROP_UNSUPPORTED,
+	// The packet is malformed, e.g., a header is too short or a checksum is wrong
+	OS_STATS_DROP_MALFORMED,
+	// The packet's lifetime is over
+	OS_STATS_DROP_EXPIRED,
+	// The packet belongs to a flow the NF does not know about and cannot create, e.g., an external packet in a NAT
+	OS_STATS_DROP_UNKNOWN_FLOW,
+	// The NF has no space left for the packet's flow
+	OS_STATS_DROP_NO_SPACE,
+	// The packet pretends to come from somewhere it cannot come from
+	OS_STATS_DROP_SPOOFING,
+	// The packet exceeds the rate allowed for its flow
+	OS_STATS_DROP_RATE_LIMIT,
+	// There is nowhere to send the packet, e.g., no available backend
+	OS_STATS_DROP_NO_DESTINATION,
+	OS_STATS_DROP_REASONS_COUNT
+};
+_Static_assert(OS_STATS_DROP_REASONS_COUNT <= OS_STATS_DROP_REASONS_MAX, "Too many drop reasons");
+
+// Counters of one core; its size is a multiple of a cache line, so that cores never share cache lines
+struct os_stats_core {
+	uint64_t rx[OS_STATS_DEVICES_MAX];
+	uint64_t tx[OS_STATS_DEVICES_MAX];
+	uint64_t drops[OS_STATS_DROP_REASONS_MAX];
+	// Number of packets the NF took a given number of TSC cycles to handle, by bucket; only filled by drivers built with STATS_LATENCY
+	uint64_t latency[OS_STATS_LATENCY_BUCKETS];
+	// Memory allocated by the core, available to it, and the NUMA node it is on, as of the end of initialization
+	uint64_t memory_used;
+	uint64_t memory_size;
+	uint64_t memory_node;
+	uint64_t _padding[5];
+} __attribute__((aligned(64)));
+
+// Cores the OS does not use, and devices that do not exist, have all-zero counters
+struct os_stats {
+	struct os_stats_core cores[OS_STATS_CORES_MAX];
+};
+
+// Counts a packet dropped by the NF for the given reason; called by NFs, on their drop paths
+void os_stats_drop(enum os_stats_drop_reason reason);
+
+// Counts packets received from a device; called by drivers. Devices beyond OS_STATS_DEVICES_MAX are not counted.
+void os_stats_rx(size_t device, size_t count);
+
+// Counts packets transmitted to a device; called by drivers. Devices beyond OS_STATS_DEVICES_MAX are not counted.
+void os_stats_tx(size_t device, size_t count);
+
+// Records how much memory the current core allocated; called by drivers once the NF is initialized, since memory cannot be allocated afterwards.
+void os_stats_memory(void);
+
+// Counts packets that the NF handled in the given number of TSC cycles, on average; called by drivers built with STATS_LATENCY around each call to the NF.
+// Calls to nf_handle_batch are timed as a whole, so the histogram then contains the average per batch rather than the exact cycles of each packet.
+void os_stats_latency(uint64_t cycles, size_t count);
+
+// Returns the latency bucket that counts the given number of cycles
+static inline size_t os_stats_latency_bucket(uint64_t cycles)
+{
+	if (cycles < (1u << OS_STATS_LATENCY_PRECISION)) {
+		return (size_t) cycles;
+	}
+	// The exponent is at least OS_STATS_LATENCY_PRECISION here; the top bit is implicit, the next OS_STATS_LATENCY_PRECISION bits pick a bucket within the power of 2
+	unsigned exponent = 63u - (unsigned) __builtin_clzll(cycles);
+	size_t bucket = ((size_t) (exponent - OS_STATS_LATENCY_PRECISION + 1) << OS_STATS_LATENCY_PRECISION) |
+			((size_t) (cycles >> (exponent - OS_STATS_LATENCY_PRECISION)) & ((1u << OS_STATS_LATENCY_PRECISION) - 1));
+	return bucket < OS_STATS_LATENCY_BUCKETS ? bucket : OS_STATS_LATENCY_BUCKETS - 1;
+}
+
+// Returns the lowest number of cycles counted by the given latency bucket, for readers
+static inline uint64_t os_stats_latency_bucket_min(size_t bucket)
+{
+	if (bucket < (1u << OS_STATS_LATENCY_PRECISION)) {
+		return bucket;
+	}
+	unsigned exponent = (unsigned) (bucket >> OS_STATS_LATENCY_PRECISION) + OS_STATS_LATENCY_PRECISION - 1;
+	uint64_t mantissa = (1u << OS_STATS_LATENCY_PRECISION) | (bucket & ((1u << OS_STATS_LATENCY_PRECISION) - 1));
+	return mantissa << (exponent - OS_STATS_LATENCY_PRECISION);
+}
@@ -8,11 +8,21 @@
 
 #define MAX_CHT_HEIGHT 40000
 
+// Consistent hashing table, as in Google's Maglev: each of the 'height' buckets has a preference list of all backends,
+// and objects are hashed to a bucket, then go to the first available backend in its preference list.
+// The preferred available backend of each bucket is cached, making lookups O(1) when it is available; NFs request a recomputation of the cache
+// with cht_request_rebuild when backends start or stop, and perform it with cht_rebuild. In the meantime, lookups that find a stale cache entry fix it.
 struct cht {
+	// Preference lists, 'backend_capacity' entries per bucket
 	uint16_t* data;
+	// Cached preferred backend of each bucket, which may not be available or not be the first available one if backends changed since the last rebuild
+	uint16_t* preferred;
 	uint16_t height;
 	uint16_t backend_capacity;
-	uint8_t _padding[4];
+	// Next bucket whose preferred backend will be recomputed by cht_rebuild
+	uint16_t rebuild_cursor;
+	// Number of buckets left to recompute before the cache reflects the latest cht_request_rebuild
+	uint16_t rebuild_remaining;
 };
 
 // @TODO: how to check that cht_height is prime ?
@@ -32,6 +42,8 @@ struct cht* cht_alloc(uint16_t cht_height, uint16_t backend_capacity);
 /*@ ensures
 	chtp(result); @*/
 
+// Finds an available backend for the given object; this is the cached preferred backend of the object's bucket if it is still available,
+// otherwise the first available backend in the bucket's preference list, which then becomes the cached one
 bool cht_find_preferred_available_backend(struct cht* cht, void* obj, size_t obj_size, struct index_pool* active_backends, uint16_t* chosen_backend, time_t time);
 /*@ requires
 	chtp(cht) &*&
@@ -46,3 +58,18 @@ bool cht_find_preferred_available_backend(struct cht* cht, void* obj, size_t obj
 		ghostmap_get(backends, index) == some(?t)) &*& result == true;
 
 @*/
+
+// Requests a recomputation of all cached preferred backends, e.g., because a backend started or stopped; this is done by cht_rebuild.
+void cht_request_rebuild(struct cht* cht);
+/*@ requires chtp(cht); @*/
+/*@ ensures chtp(cht); @*/
+
+// Recomputes the cached preferred backend of up to 'max_buckets' buckets if a recomputation is pending,
+// so that NFs can keep the cache up to date "in the background" by calling this with a small budget while processing packets.
+//   returns whether the cache is up to date, i.e., whether no recomputation is pending any more
+bool cht_rebuild(struct cht* cht, struct index_pool* active_backends, time_t time, uint16_t max_buckets);
+/*@ requires
+	chtp(cht) &*&
+	poolp(active_backends, ?size, ?backends) &*& cht->backend_capacity <= size; @*/
+/*@ ensures
+	chtp(cht) &*& poolp(active_backends, size, backends); @*/
@@ -1,20 +1,26 @@
+#pragma once
+
 #include <stdbool.h>
+#include <stddef.h>
 
 // NOTE: The LPM copies the keys and values it is given, ownership is not transferred.
+// Keys are interpreted as native-endian unsigned integers, and the prefix of a given width is made of the key's most significant bits.
+// 4-byte keys (i.e., IPv4 addresses) use a DIR-24-8 table, making searches cost at most two memory accesses plus the value copy;
+// other key sizes use one hash lookup per prefix width actually present in the LPM, from the longest to the shortest.
 
 struct lpm;
 
 // Creates a longer prefix match data structure
-//   key_size: The key size, in bytes
+//   key_size: The key size, in bytes; must be at most 31 so that widths fit in a byte
 //   value_size: The value size, in bytes
-//   capacity: The maximal capacity
+//   capacity: The maximal capacity; must be below 2^24 for 4-byte keys
 struct lpm* lpm_alloc(size_t key_size, size_t value_size, size_t capacity);
 
 // Sets a key/width, value pair in the lpm
-// precondition: the key combined with the width must not already exist in the lpm
+// If the key combined with the width already exists in the lpm, its value is overwritten
 // precondition: the width cannot be greater than key_size * 8
 // postcondition: the number of elements in the lpm cannot exceed the lpm capacity.
-//   returns whether the set succeeded (= there was free space)
+//   returns whether the set succeeded (= there was free space; for 4-byte keys, prefixes longer than 24 bits also need a free second-level table)
 bool lpm_set(struct lpm* lpm, void* key, size_t width, void* value);
 
 // Performs a longest prefix match search on the lpm.
@@ -8,8 +8,14 @@
 
 // Holds key-value pairs; note that values are always of type size_t
 // Ownership of the keys is partially transfered to the map, they are not copied
+// (except when building with STRUCTS_MAP=inline, which copies keys into the map and thus keeps no ownership;
+//  Klint must then be run with --map-inline-keys, which checks NFs against contracts requiring key_size <= MAP_INLINE_KEY_SIZE_MAX
+//  and returning the keys' ownership as soon as map_set returns, so that NFs may reuse a key's memory while it is in the map)
 struct map;
 
+// Maximum key size for maps built with STRUCTS_MAP=inline, which fits an Ethernet address and an IPv4 5-tuple
+#define MAP_INLINE_KEY_SIZE_MAX 16
+
 //@ predicate mapp(struct map* map, size_t key_size, size_t capacity, list<pair<list<char>, size_t> > values, list<pair<list<char>, void*> > addrs);
 
 // Allocates a map for keys of the given size (in bytes) and integral values (size_t) with the given capacity.
@@ -38,6 +44,49 @@ bool map_get(struct map* map, void* key_ptr, size_t* out_value);
 	    }; @*/
 //@ terminates;
 
+/*@
+predicate keys_chars(list<void*> key_ptrs, size_t key_size; list<list<char> > keys) =
+	switch (key_ptrs) {
+	  case nil: return keys == nil;
+	  case cons(h, t): return h != NULL &*& [_]chars(h, key_size, ?k) &*& keys_chars(t, key_size, ?ks) &*& keys == cons(k, ks);
+	};
+
+fixpoint bool map_batch_result(list<pair<list<char>, size_t> > values, list<char> key, size_t value, bool found) {
+	switch (ghostmap_get(values, key)) {
+	  case none: return found == false;
+	  case some(v): return found == true && value == v;
+	}
+}
+
+fixpoint bool map_batch_results(list<pair<list<char>, size_t> > values, list<list<char> > keys, list<size_t> out_values, list<bool> out_found) {
+	switch (keys) {
+	  case nil: return true;
+	  case cons(k, ks): return map_batch_result(values, k, head(out_values), head(out_found)) && map_batch_results(values, ks, tail(out_values), tail(out_found));
+	}
+}
+@*/
+
+// Tries to get the values associated with the given keys, with the same effect as calling map_get on each of them,
+// but faster since the cache misses of all lookups overlap instead of being serialized.
+//   map: the map the keys will be searched in
+//   keys: pointers to the keys, which must not be NULL
+//   count: number of keys
+//   out_values: out_values[n] will be set to the value associated with keys[n] if it is present in the map, and is unspecified otherwise
+//   out_found: out_found[n] will be set to whether keys[n] is present in the map
+void map_get_batch(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found);
+/*@ requires mapp(map, ?key_size, ?capacity, ?values, ?addrs) &*&
+	     keys[0..count] |-> ?key_ptrs &*&
+	     keys_chars(key_ptrs, key_size, ?key_list) &*&
+	     out_values[0..count] |-> _ &*&
+	     out_found[0..count] |-> _; @*/
+/*@ ensures mapp(map, key_size, capacity, values, addrs) &*&
+	    keys[0..count] |-> key_ptrs &*&
+	    keys_chars(key_ptrs, key_size, key_list) &*&
+	    out_values[0..count] |-> ?values_list &*&
+	    out_found[0..count] |-> ?found_list &*&
+	    true == map_batch_results(values, key_list, values_list, found_list); @*/
+//@ terminates;
+
 // Sets the value associated with the given key in the map, requiring space to be available and the key to not already be there.
 //   map: pointer to the map
 //   key_ptr: pointer to the key that will be added to the map, must not be NULL
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "os/time.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Tracks expiration times of indices, e.g., those of an index_pool, so that NFs can eagerly clean up the state associated with expired indices
+// doing a bounded amount of work per packet, instead of discovering expired indices as they are needed.
+// Times are rounded to a granularity: an index scheduled to expire at time T is reported by timer_wheel_pop_expired at a time strictly greater than T,
+// but possibly up to 'granularity' later. Time should not go backwards, though if it does indices are still never reported early.
+// The amount of work done by timer_wheel_pop_expired is proportional to the number of timers it has to move within the wheel,
+// which is amortized constant per timer, plus a small constant per "interesting" point in time elapsed since the last call.
+
+struct timer_wheel;
+
+// Allocates a timer wheel for indices in [0, capacity), none of which are initially scheduled.
+//   granularity: precision of the expiration times, must be greater than 0
+struct timer_wheel* timer_wheel_alloc(size_t capacity, time_t granularity);
+
+// Schedules the given index to expire at the given time, replacing any previous expiration time it had.
+// precondition: index < capacity
+void timer_wheel_schedule(struct timer_wheel* wheel, size_t index, time_t expiration_time);
+
+// Cancels the expiration of the given index, if it was scheduled.
+// precondition: index < capacity
+void timer_wheel_cancel(struct timer_wheel* wheel, size_t index);
+
+// Tries to get an index that has expired as of the given time, i.e., one whose expiration time is strictly lower than the given time,
+// in which case the index is no longer scheduled. NFs can call this a bounded number of times per packet to spread the cleanup.
+//   out_index: stores the expired index iff there is one
+//   returns whether there was an expired index
+bool timer_wheel_pop_expired(struct timer_wheel* wheel, time_t time, size_t* out_index);
@@ -3,8 +3,15 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Devices access rings and packet buffers by physical address, thus each must be physically contiguous, but memory may be made of pages that are not contiguous with each other.
+// Pages are at least 4 KB and aligned to their size, so an object whose size is a power of 2 of at most 4 KB and which is aligned to its size never crosses a page boundary.
+
+// Allocates a ring of 'count' 16-byte descriptors, aligned to its size; count * 16 must be a power of 2 of at most 4 KB.
 uint64_t* descriptor_ring_alloc(size_t count);
 
+// Allocates 'count' packet buffers of 'size' bytes, aligned to 'size'; size must be a power of 2 of at most 4 KB.
+void* packet_buffers_alloc(size_t count, size_t size);
+
 void* agents_alloc(size_t count, size_t size);
 
 typedef void foreach_index_forever_function(size_t index, void* state);
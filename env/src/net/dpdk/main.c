@@ -2,53 +2,147 @@
 #include "net/tx.h"
 #include "os/clock.h"
 #include "os/init.h"
+#include "os/stats.h"
 
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <rte_cycles.h>
 #include <rte_debug.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_ether.h>
+#include <rte_launch.h>
 #include <rte_lcore.h>
+#include <rte_malloc.h>
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
+#include <rte_per_lcore.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Just needs to be high enough to not run out of buffers
+// Just needs to be high enough to not run out of buffers; this is per device and per lcore
 #define MEMPOOL_BUFFER_COUNT 1024
 
+// Per-lcore cache of the mempool, so that lcores do not contend on the pool itself
+#define MEMPOOL_CACHE_SIZE 256
+
 // We handle the BATCH_SIZE == 1 case specially, but others are subject to DPDK constraints, e.g. not too small
 #if BATCH_SIZE + 0 == 0
 #error Please define BATCH_SIZE
 #endif
 
-#define MAX_DEVICES 2
-// TODO properly do refcount shenanigans
-_Static_assert(MAX_DEVICES == 2, "see todo");
+// Maximum time packets can wait in a partially filled TX buffer, as in DPDK's l2fwd example
+#define TX_DRAIN_US 100
+
+#define MAX_DEVICES RTE_MAX_ETHPORTS
+
+// Symmetric RSS key (Woo & Park, "Scalable TCP Session Monitoring with Symmetric Receive-side Scaling", 2012),
+// so that both directions of a flow are handled by the same lcore and thus by the same NF instance
+#define RSS_KEY_SIZE 40
+static uint8_t rss_key[RSS_KEY_SIZE] = {
+    0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A,
+    0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A, 0x6D, 0x5A,
+};
 
 static device_t devices_count;
 static struct rte_ether_addr device_addrs[MAX_DEVICES];
 static struct rte_ether_addr endpoint_addrs[MAX_DEVICES];
 
-static uint16_t bufs_to_tx_count[MAX_DEVICES];
-static struct rte_mbuf* bufs_to_tx[MAX_DEVICES][BATCH_SIZE];
+// Each lcore runs its own instance of the NF, so that NF state is not shared across lcores
+struct nf_instance {
+	bool (*init)(device_t);
+	void (*handle)(struct net_packet*);
+	void (*handle_batch)(struct net_packet*, size_t);
+};
+
+// Each lcore has a worker, which polls one RX queue and owns one TX queue per device
+struct worker {
+	struct nf_instance nf;
+	uint16_t queue;
+	// Packets given to the NF
+	struct net_packet packets[BATCH_SIZE];
+	// Transmissions are buffered across RX bursts, and sent once a buffer is full or has waited for TX_DRAIN_US
+	uint16_t bufs_to_tx_count[MAX_DEVICES];
+	struct rte_mbuf* bufs_to_tx[MAX_DEVICES][BATCH_SIZE];
+};
+
+static RTE_DEFINE_PER_LCORE(struct worker*, current_worker);
 
-static void device_init(device_t device, struct rte_mempool* mbuf_pool)
+// The first NF instance is the one the binary is linked against; others are copies of the same library,
+// since the dynamic loader would otherwise return the already-loaded one.
+// RTLD_DEEPBIND makes each copy use its own globals, while still using the environment's functions from the binary.
+static struct nf_instance nf_instance_load(void)
+{
+	int file = open(NF_PATH, O_RDONLY);
+	if (file < 0) {
+		rte_panic("Couldn't open the NF library");
+	}
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0) {
+		rte_panic("Couldn't stat the NF library");
+	}
+	int copy = memfd_create("nf", 0);
+	if (copy < 0) {
+		rte_panic("Couldn't create a copy of the NF library");
+	}
+	off_t offset = 0;
+	while (offset < file_stat.st_size) {
+		if (sendfile(copy, file, &offset, (size_t) (file_stat.st_size - offset)) <= 0) {
+			rte_panic("Couldn't copy the NF library");
+		}
+	}
+	close(file);
+
+	char copy_path[32];
+	snprintf(copy_path, sizeof(copy_path), "/proc/self/fd/%d", copy);
+	void* library = dlopen(copy_path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+	if (library == NULL) {
+		rte_panic("Couldn't load a copy of the NF library: %s", dlerror());
+	}
+	close(copy);
+
+	struct nf_instance instance;
+	*(void**) &(instance.init) = dlsym(library, "nf_init");
+	*(void**) &(instance.handle) = dlsym(library, "nf_handle");
+	*(void**) &(instance.handle_batch) = dlsym(library, "nf_handle_batch");
+	if (instance.init == NULL || instance.handle == NULL) {
+		rte_panic("Couldn't find the NF functions in the NF library copy");
+	}
+	return instance;
+}
+
+static void device_init(device_t device, uint16_t queues_count, struct rte_mempool* mbuf_pool)
 {
 	int ret;
 
 	struct rte_eth_conf device_conf = {0};
-	ret = rte_eth_dev_configure(device, 1, 1, &device_conf);
+	if (queues_count > 1) {
+		struct rte_eth_dev_info device_info;
+		rte_eth_dev_info_get(device, &device_info);
+		device_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+		device_conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+		device_conf.rx_adv_conf.rss_conf.rss_key_len = RSS_KEY_SIZE;
+		device_conf.rx_adv_conf.rss_conf.rss_hf = (ETH_RSS_IP | ETH_RSS_TCP | ETH_RSS_UDP) & device_info.flow_type_rss_offloads;
+	}
+	ret = rte_eth_dev_configure(device, queues_count, queues_count, &device_conf);
 	if (ret != 0) {
 		rte_panic("Couldn't configure device");
 	}
 
-	ret = rte_eth_tx_queue_setup(device, 0, BATCH_SIZE == 1 ? 96 : 0, rte_eth_dev_socket_id(device), NULL /* default config */);
-	if (ret != 0) {
-		rte_panic("Couldn't configure a TX queue");
-	}
+	for (uint16_t queue = 0; queue < queues_count; queue++) {
+		ret = rte_eth_tx_queue_setup(device, queue, BATCH_SIZE == 1 ? 96 : 0, rte_eth_dev_socket_id(device), NULL /* default config */);
+		if (ret != 0) {
+			rte_panic("Couldn't configure a TX queue");
+		}
 
-	ret = rte_eth_rx_queue_setup(device, 0, BATCH_SIZE == 1 ? 96 : 0, rte_eth_dev_socket_id(device), NULL /* default config */, mbuf_pool);
-	if (ret != 0) {
-		rte_panic("Couldn't configure an RX queue");
+		ret = rte_eth_rx_queue_setup(device, queue, BATCH_SIZE == 1 ? 96 : 0, rte_eth_dev_socket_id(device), NULL /* default config */, mbuf_pool);
+		if (ret != 0) {
+			rte_panic("Couldn't configure an RX queue");
+		}
 	}
 
 	ret = rte_eth_dev_start(device);
@@ -77,12 +171,35 @@ static void handle_flags(struct net_packet* packet, device_t device, enum net_tr
 	}
 }
 
-// TODO make sure we never get multiple net_transmit calls for the same mbuf? or handle it? idk
+static void tx_flush(struct worker* worker, device_t device)
+{
+	uint16_t nb_tx = rte_eth_tx_burst(device, worker->queue, worker->bufs_to_tx[device], worker->bufs_to_tx_count[device]);
+	os_stats_tx(device, nb_tx);
+	for (uint16_t n = nb_tx; n < worker->bufs_to_tx_count[device]; n++) {
+		rte_pktmbuf_free(worker->bufs_to_tx[device][n]);
+	}
+	worker->bufs_to_tx_count[device] = 0;
+}
+
+static void tx_enqueue(struct net_packet* packet, device_t device)
+{
+	struct worker* worker = RTE_PER_LCORE(current_worker);
+	struct rte_mbuf* buf = (struct rte_mbuf*) packet->os_tag;
+	// Every transmission needs its own reference, since TX frees the mbuf once, possibly before the NF is done with the packet, e.g., when flooding;
+	// the reference we got from RX is released once the NF returns
+	rte_mbuf_refcnt_update(buf, 1);
+
+	worker->bufs_to_tx[device][worker->bufs_to_tx_count[device]] = buf;
+	worker->bufs_to_tx_count[device] = worker->bufs_to_tx_count[device] + 1;
+	if (worker->bufs_to_tx_count[device] == BATCH_SIZE) {
+		tx_flush(worker, device);
+	}
+}
+
 void net_transmit(struct net_packet* packet, device_t device, enum net_transmit_flags flags)
 {
 	handle_flags(packet, device, flags);
-	bufs_to_tx[device][bufs_to_tx_count[device]] = (struct rte_mbuf*) packet->os_tag;
-	bufs_to_tx_count[device] = bufs_to_tx_count[device] + 1;
+	tx_enqueue(packet, device);
 }
 
 void net_flood(struct net_packet* packet, enum net_transmit_flags flags)
@@ -90,8 +207,7 @@ void net_flood(struct net_packet* packet, enum net_transmit_flags flags)
 	for (device_t device = 0; device < devices_count; device++) {
 		if (packet->device != device) {
 			handle_flags(packet, device, flags);
-			bufs_to_tx[device][bufs_to_tx_count[device]] = (struct rte_mbuf*) packet->os_tag;
-			bufs_to_tx_count[device] = bufs_to_tx_count[device] + 1;
+			tx_enqueue(packet, device);
 		}
 	}
 }
@@ -101,12 +217,83 @@ void net_flood_except(struct net_packet* packet, bool* disabled_devices, enum ne
 	for (device_t device = 0; device < devices_count; device++) {
 		if (packet->device != device && !disabled_devices[device]) {
 			handle_flags(packet, device, flags);
-			bufs_to_tx[device][bufs_to_tx_count[device]] = (struct rte_mbuf*) packet->os_tag;
-			bufs_to_tx_count[device] = bufs_to_tx_count[device] + 1;
+			tx_enqueue(packet, device);
 		}
 	}
 }
 
+// Initializes the worker's NF instance on the worker's own lcore, so that NF memory is allocated on the lcore's socket
+static int worker_init(void* arg)
+{
+	struct worker* worker = (struct worker*) arg;
+	if (!worker->nf.init(devices_count)) {
+		return -1;
+	}
+	os_stats_memory();
+	return 0;
+}
+
+static int worker_run(void* arg)
+{
+	struct worker* worker = (struct worker*) arg;
+	RTE_PER_LCORE(current_worker) = worker;
+
+	const uint64_t drain_cycles = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * TX_DRAIN_US;
+	uint64_t last_drain = rte_rdtsc();
+	while (1) {
+		for (device_t device = 0; device < devices_count; device++) {
+			struct rte_mbuf* bufs[BATCH_SIZE];
+			uint16_t nb_rx = rte_eth_rx_burst(device, worker->queue, bufs, BATCH_SIZE);
+			// NFs are only ever given at least one packet, and empty polls should be as cheap as possible
+			if (nb_rx == 0) {
+				continue;
+			}
+			os_stats_rx(device, nb_rx);
+			// All packets of a burst share a timestamp
+			time_t now = os_clock_time_ns();
+			for (uint16_t n = 0; n < nb_rx; n++) {
+				worker->packets[n] = (struct net_packet){
+				    .data = (char*) bufs[n]->buf_addr + bufs[n]->data_off, .length = bufs[n]->data_len, .time = now, .device = bufs[n]->port, .os_tag = bufs[n]};
+			}
+			if (worker->nf.handle_batch != NULL) {
+#ifdef STATS_LATENCY
+				uint64_t start = rte_rdtsc();
+				worker->nf.handle_batch(worker->packets, nb_rx);
+				os_stats_latency(rte_rdtsc() - start, nb_rx);
+#else
+				worker->nf.handle_batch(worker->packets, nb_rx);
+#endif
+			} else {
+				for (uint16_t n = 0; n < nb_rx; n++) {
+#ifdef STATS_LATENCY
+					uint64_t start = rte_rdtsc();
+					worker->nf.handle(&(worker->packets[n]));
+					os_stats_latency(rte_rdtsc() - start, 1);
+#else
+					worker->nf.handle(&(worker->packets[n]));
+#endif
+				}
+			}
+			// Release the RX references, which drops the packets the NF did not transmit
+			for (uint16_t n = 0; n < nb_rx; n++) {
+				rte_pktmbuf_free(bufs[n]);
+			}
+		}
+
+		uint64_t now = rte_rdtsc();
+		if (now - last_drain > drain_cycles) {
+			for (device_t device = 0; device < devices_count; device++) {
+				if (worker->bufs_to_tx_count[device] != 0) {
+					tx_flush(worker, device);
+				}
+			}
+			last_drain = now;
+		}
+	}
+
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	// Initialize DPDK, and change argc/argv to look like nothing happened
@@ -127,43 +314,63 @@ int main(int argc, char** argv)
 		rte_panic("Too many devices, please increase MAX_DEVICES");
 	}
 
-	struct rte_mempool* mbuf_pool = rte_pktmbuf_pool_create("MEMPOOL",			      // name
-								MEMPOOL_BUFFER_COUNT * devices_count, // #elements
-								0,				      // cache size (per-lcore, not useful in a single-threaded app)
-								0,				      // application private area size
-								RTE_MBUF_DEFAULT_BUF_SIZE,	      // data buffer size
-								rte_socket_id()			      // socket ID
+	// One worker, and thus one queue per device, per lcore
+	uint16_t workers_count = (uint16_t) rte_lcore_count();
+	// Each worker has its own NF instance, which is only consistent for NFs whose state is per flow, since RSS sends both directions of a flow to the same lcore
+	if (workers_count > 1 && (&nf_per_flow_state == NULL || !nf_per_flow_state)) {
+		rte_panic("The NF's state is not per flow, thus it cannot run on multiple lcores");
+	}
+
+	struct rte_mempool* mbuf_pool = rte_pktmbuf_pool_create("MEMPOOL",					 // name
+								MEMPOOL_BUFFER_COUNT * devices_count * workers_count, // #elements
+								MEMPOOL_CACHE_SIZE,				 // cache size (per-lcore)
+								0,						 // application private area size
+								RTE_MBUF_DEFAULT_BUF_SIZE,			 // data buffer size
+								rte_socket_id()					 // socket ID
 	);
 	if (mbuf_pool == NULL) {
 		rte_panic("Cannot create DPDK pool");
 	}
 
 	for (device_t device = 0; device < devices_count; device++) {
-		device_init(device, mbuf_pool);
+		device_init(device, workers_count, mbuf_pool);
+	}
+
+	// The main lcore handles queue 0 with the linked NF instance, others get their own copy of the NF
+	unsigned lcores[RTE_MAX_LCORE];
+	struct worker* workers[RTE_MAX_LCORE];
+	unsigned lcore = rte_get_master_lcore();
+	for (uint16_t w = 0; w < workers_count; w++) {
+		lcores[w] = lcore;
+		workers[w] = (struct worker*) rte_zmalloc_socket("worker", sizeof(struct worker), RTE_CACHE_LINE_SIZE, (int) rte_lcore_to_socket_id(lcore));
+		if (workers[w] == NULL) {
+			rte_panic("Couldn't allocate a worker");
+		}
+		workers[w]->queue = w;
+		if (w == 0) {
+			workers[w]->nf = (struct nf_instance){.init = nf_init, .handle = nf_handle, .handle_batch = nf_handle_batch};
+		} else {
+			workers[w]->nf = nf_instance_load();
+		}
+		lcore = rte_get_next_lcore(lcore, 1, 0);
 	}
 
-	if (!nf_init(devices_count)) {
+	// NF initialization is sequential, since OS memory allocation may not be thread-safe
+	if (worker_init(workers[0]) != 0) {
 		rte_panic("Initialization failed.");
 	}
+	for (uint16_t w = 1; w < workers_count; w++) {
+		if (rte_eal_remote_launch(worker_init, workers[w], lcores[w]) != 0 || rte_eal_wait_lcore(lcores[w]) != 0) {
+			rte_panic("Initialization failed.");
+		}
+	}
 
-	while (1) {
-		for (device_t device = 0; device < devices_count; device++) {
-			struct rte_mbuf* bufs[BATCH_SIZE];
-			uint16_t nb_rx = rte_eth_rx_burst(device, 0, bufs, BATCH_SIZE);
-			for (int16_t n = 0; n < nb_rx; n++) {
-				struct net_packet packet = {
-				    .data = (char*) bufs[n]->buf_addr + bufs[n]->data_off, .length = bufs[n]->data_len, .time = os_clock_time_ns(), .device = bufs[n]->port, .os_tag = bufs[n]};
-				nf_handle(&packet);
-			}
-			for (device_t out_device = 0; out_device < devices_count; out_device++) {
-				uint16_t nb_tx = rte_eth_tx_burst(out_device, 0, bufs_to_tx[out_device], bufs_to_tx_count[out_device]);
-				for (uint16_t n = nb_tx; n < bufs_to_tx_count[out_device]; n++) {
-					rte_pktmbuf_free(bufs_to_tx[out_device][n]);
-				}
-				bufs_to_tx_count[out_device] = 0;
-			}
+	for (uint16_t w = 1; w < workers_count; w++) {
+		if (rte_eal_remote_launch(worker_run, workers[w], lcores[w]) != 0) {
+			rte_panic("Couldn't launch a worker");
 		}
 	}
+	worker_run(workers[0]);
 
 	return 0;
 }
@@ -0,0 +1,319 @@
+#include "arch/tsc.h"
+#include "net/skeleton.h"
+#include "os/clock.h"
+#include "os/init.h"
+#include "os/memory.h"
+
+// We already have a time_t, don't re-define it (first for glibc, second for musl)
+#define __time_t_defined 1
+#define __DEFINED_time_t 1
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Replays pcap traces through the NF as fast as possible, without any NIC, for benchmarking and regression testing.
+// Usage: bin <passes> <device 0 trace> [<device 1 trace> ...]
+// Each trace file holds the packets received by one device. A warm-up pass replays all traces once while writing the packets transmitted
+// on each device to "tx<device>.pcap" in the current directory, then the given number of passes are replayed and measured.
+// Packets are copied to a working buffer before being handed to the NF, as a NIC would, since NFs may modify them.
+
+#if BATCH_SIZE + 0 == 0
+#error Please define BATCH_SIZE
+#endif
+
+// Larger than any non-jumbo Ethernet frame
+#define PACKET_BUFFER_SIZE 2048
+
+// See https://wiki.wireshark.org/Development/LibpcapFileFormat
+#define PCAP_MAGIC_MICROS 0xA1B2C3D4u
+#define PCAP_MAGIC_NANOS 0xA1B23C4Du
+#define PCAP_LINKTYPE_ETHERNET 1u
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+struct trace {
+	char** packets;
+	size_t* lengths;
+	size_t count;
+	size_t next;
+	FILE* tx_file;
+};
+
+static device_t devices_count;
+static struct trace* traces;
+static struct net_ether_addr* endpoint_macs;
+static struct net_ether_addr* device_macs;
+
+static struct net_packet packets[BATCH_SIZE];
+static char (*packet_buffers)[PACKET_BUFFER_SIZE];
+static bool packets_transmitted[BATCH_SIZE];
+
+static uint64_t* tx_counts;
+static uint64_t drop_count;
+
+static void fail(const char* message, const char* detail)
+{
+	fprintf(stderr, "%s: %s\n", message, detail);
+	exit(1);
+}
+
+static void trace_load(const char* path, struct trace* trace)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		fail("Could not open trace", path);
+	}
+	if (fseek(file, 0, SEEK_END) != 0) {
+		fail("Could not seek in trace", path);
+	}
+	long file_size = ftell(file);
+	if (file_size < (long) sizeof(struct pcap_file_header)) {
+		fail("Trace is too small to be a pcap file", path);
+	}
+	rewind(file);
+
+	char* data = os_memory_alloc((size_t) file_size, 1);
+	if (fread(data, 1, (size_t) file_size, file) != (size_t) file_size) {
+		fail("Could not read trace", path);
+	}
+	fclose(file);
+
+	struct pcap_file_header header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != PCAP_MAGIC_MICROS && header.magic != PCAP_MAGIC_NANOS) {
+		fail("Not a native-endian pcap file", path);
+	}
+	if (header.linktype != PCAP_LINKTYPE_ETHERNET) {
+		fail("Not an Ethernet trace", path);
+	}
+
+	// First count packets, then index them
+	for (int pass = 0; pass < 2; pass++) {
+		size_t count = 0;
+		size_t offset = sizeof(struct pcap_file_header);
+		while (offset + sizeof(struct pcap_record_header) <= (size_t) file_size) {
+			struct pcap_record_header record;
+			memcpy(&record, data + offset, sizeof(record));
+			offset += sizeof(record);
+			if (record.incl_len > (size_t) file_size - offset) {
+				fail("Truncated packet in trace", path);
+			}
+			if (record.incl_len > PACKET_BUFFER_SIZE) {
+				fail("Packet too large in trace", path);
+			}
+			if (pass == 1) {
+				trace->packets[count] = data + offset;
+				trace->lengths[count] = record.incl_len;
+			}
+			offset += record.incl_len;
+			count++;
+		}
+		if (count == 0) {
+			fail("Empty trace", path);
+		}
+		if (pass == 0) {
+			trace->packets = os_memory_alloc(count, sizeof(char*));
+			trace->lengths = os_memory_alloc(count, sizeof(size_t));
+		}
+		trace->count = count;
+	}
+}
+
+static FILE* tx_file_open(device_t device)
+{
+	char path[32];
+	snprintf(path, sizeof(path), "tx%u.pcap", (unsigned) device);
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		fail("Could not create TX trace", path);
+	}
+	struct pcap_file_header header = {
+	    .magic = PCAP_MAGIC_NANOS, .version_major = 2, .version_minor = 4, .thiszone = 0, .sigfigs = 0, .snaplen = PACKET_BUFFER_SIZE, .linktype = PCAP_LINKTYPE_ETHERNET};
+	fwrite(&header, sizeof(header), 1, file);
+	return file;
+}
+
+static void tx_file_write(FILE* file, struct net_packet* packet)
+{
+	struct pcap_record_header record = {.ts_sec = (uint32_t) (packet->time / 1000000000ull),
+					    .ts_frac = (uint32_t) (packet->time % 1000000000ull),
+					    .incl_len = (uint32_t) packet->length,
+					    .orig_len = (uint32_t) packet->length};
+	fwrite(&record, sizeof(record), 1, file);
+	fwrite(packet->data, 1, packet->length, file);
+}
+
+static void handle_flags(struct net_packet* packet, device_t device, enum net_transmit_flags flags)
+{
+	if ((flags & UPDATE_ETHER_ADDRS) != 0) {
+		struct net_ether_header* header = (struct net_ether_header*) packet->data;
+		header->dst_addr = endpoint_macs[device];
+		header->src_addr = device_macs[device];
+	}
+}
+
+static void tx(struct net_packet* packet, device_t device)
+{
+	packets_transmitted[packet - packets] = true;
+	tx_counts[device] = tx_counts[device] + 1;
+	if (traces[device].tx_file != NULL) {
+		tx_file_write(traces[device].tx_file, packet);
+	}
+}
+
+void net_transmit(struct net_packet* packet, device_t device, enum net_transmit_flags flags)
+{
+	handle_flags(packet, device, flags);
+	tx(packet, device);
+}
+
+void net_flood(struct net_packet* packet, enum net_transmit_flags flags)
+{
+	for (device_t device = 0; device < devices_count; device++) {
+		if (packet->device != device) {
+			handle_flags(packet, device, flags);
+			tx(packet, device);
+		}
+	}
+}
+
+void net_flood_except(struct net_packet* packet, bool* disabled_devices, enum net_transmit_flags flags)
+{
+	for (device_t device = 0; device < devices_count; device++) {
+		if (packet->device != device && !disabled_devices[device]) {
+			handle_flags(packet, device, flags);
+			tx(packet, device);
+		}
+	}
+}
+
+// Replays every trace once, interleaving devices one batch at a time, and returns the number of packets replayed
+static uint64_t replay_pass(void)
+{
+	uint64_t total = 0;
+	for (device_t device = 0; device < devices_count; device++) {
+		traces[device].next = 0;
+	}
+	bool any_left = true;
+	while (any_left) {
+		any_left = false;
+		for (device_t device = 0; device < devices_count; device++) {
+			struct trace* trace = &(traces[device]);
+			size_t count = trace->count - trace->next;
+			if (count == 0) {
+				continue;
+			}
+			if (count > BATCH_SIZE) {
+				count = BATCH_SIZE;
+			}
+
+			// All packets of a batch share a timestamp, as with real drivers
+			time_t now = os_clock_time_ns();
+			for (size_t n = 0; n < count; n++) {
+				size_t length = trace->lengths[trace->next + n];
+				memcpy(packet_buffers[n], trace->packets[trace->next + n], length);
+				packets[n] = (struct net_packet){
+				    .data = packet_buffers[n],
+				    .length = length,
+				    .time = now,
+				    .device = device,
+				};
+				packets_transmitted[n] = false;
+			}
+			net_handle_batch(packets, count);
+			for (size_t n = 0; n < count; n++) {
+				if (!packets_transmitted[n]) {
+					drop_count = drop_count + 1;
+				}
+			}
+
+			trace->next += count;
+			total += count;
+			any_left |= trace->next != trace->count;
+		}
+	}
+	return total;
+}
+
+static void counts_reset(void)
+{
+	for (device_t device = 0; device < devices_count; device++) {
+		tx_counts[device] = 0;
+	}
+	drop_count = 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		fail("Usage", "bin <passes> <device 0 trace> [<device 1 trace> ...]");
+	}
+	unsigned long passes = strtoul(argv[1], NULL, 10);
+	if (passes == 0) {
+		fail("Invalid number of passes", argv[1]);
+	}
+
+	os_init();
+
+	devices_count = (device_t) (argc - 2);
+	traces = os_memory_alloc(devices_count, sizeof(struct trace));
+	endpoint_macs = os_memory_alloc(devices_count, sizeof(struct net_ether_addr));
+	device_macs = os_memory_alloc(devices_count, sizeof(struct net_ether_addr));
+	tx_counts = os_memory_alloc(devices_count, sizeof(uint64_t));
+	packet_buffers = os_memory_alloc(BATCH_SIZE, PACKET_BUFFER_SIZE);
+	for (device_t device = 0; device < devices_count; device++) {
+		trace_load(argv[device + 2], &(traces[device]));
+		// Locally administered addresses that identify the device
+		endpoint_macs[device] = (struct net_ether_addr){.bytes = {0x02, 0, 0, 0, 1, (uint8_t) device}};
+		device_macs[device] = (struct net_ether_addr){.bytes = {0x02, 0, 0, 0, 0, (uint8_t) device}};
+	}
+
+	if (!nf_init(devices_count)) {
+		fail("NF failed to init", argv[0]);
+	}
+
+	// Warm-up pass, which also records transmitted packets
+	for (device_t device = 0; device < devices_count; device++) {
+		traces[device].tx_file = tx_file_open(device);
+	}
+	replay_pass();
+	for (device_t device = 0; device < devices_count; device++) {
+		fclose(traces[device].tx_file);
+		traces[device].tx_file = NULL;
+	}
+	counts_reset();
+
+	uint64_t packets_count = 0;
+	time_t start_time = os_clock_time_ns();
+	uint64_t start_cycles = tsc_get();
+	for (unsigned long pass = 0; pass < passes; pass++) {
+		packets_count += replay_pass();
+	}
+	uint64_t cycles = tsc_get() - start_cycles;
+	time_t duration = os_clock_time_ns() - start_time;
+
+	printf("Packets: %" PRIu64 "\n", packets_count);
+	printf("Mpps: %.3f\n", (double) packets_count * 1000.0 / (double) duration);
+	printf("Cycles/packet: %.1f\n", (double) cycles / (double) packets_count);
+	for (device_t device = 0; device < devices_count; device++) {
+		printf("Transmitted on device %u: %" PRIu64 "\n", (unsigned) device, tx_counts[device]);
+	}
+	printf("Dropped: %" PRIu64 "\n", drop_count);
+	return 0;
+}
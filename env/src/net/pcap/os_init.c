@@ -0,0 +1,66 @@
+#include "os/init.h"
+
+#include "arch/tsc.h"
+#include "os/clock.h"
+#include "os/log.h"
+#include "os/memory.h"
+#include "os/stats.h"
+
+// We already have a time_t, don't re-define it (first for glibc, second for musl)
+#define __time_t_defined 1
+#define __DEFINED_time_t 1
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// For clock.h
+uint64_t cpu_freq_multiplier;
+uint64_t cpu_freq_shift;
+
+// For the shared memory_alloc.c
+char* memory;
+size_t memory_used_len;
+
+// For the linux stats.c; the counters are private to the process since there is a single core
+struct os_stats_core* stats_core;
+size_t memory_node;
+
+static struct os_stats stats;
+
+// From the linux OS layer's clock.c
+void linux_tsc_calibrate(uint64_t* out_numerator, uint64_t* out_denominator);
+
+// Replaces the init.c of the linux OS layer: replaying traces needs neither devices nor pinned memory,
+// so there is no need for ioperm, hugepages or the MSRs, all of which need privileges.
+void os_init(void)
+{
+	uint64_t freq_numerator;
+	uint64_t freq_denominator;
+	linux_tsc_calibrate(&freq_numerator, &freq_denominator);
+	tsc_get_ns_conversion(freq_numerator, freq_denominator, &cpu_freq_multiplier, &cpu_freq_shift);
+
+	// A plain mapping, which is zero-initialized as the allocator expects; transparent hugepages are good enough to keep TLB misses out of the measurements
+	memory = mmap(NULL, OS_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		os_debug("Could not allocate memory");
+		abort();
+	}
+	madvise(memory, OS_MEMORY_SIZE, MADV_HUGEPAGE);
+	// Fault the pages in now, so that the first replay pass does not measure page faults
+	for (size_t offset = 0; offset < OS_MEMORY_SIZE; offset += 4096) {
+		((volatile char*) memory)[offset] = 0;
+	}
+	memory_used_len = 0;
+	memory_node = 0;
+
+	stats_core = &(stats.cores[0]);
+}
+
+size_t os_init_cores(size_t count)
+{
+	if (count != 1) {
+		os_debug("The pcap replay network layer only supports a single core");
+		abort();
+	}
+	return 0;
+}
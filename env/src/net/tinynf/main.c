@@ -1,3 +1,4 @@
+#include "arch/tsc.h"
 #include "net/skeleton.h"
 #include "network.h"
 #include "os/clock.h"
@@ -5,13 +6,23 @@
 #include "os/log.h"
 #include "os/memory.h"
 #include "os/pci.h"
+#include "os/stats.h"
 #include "verif/drivers.h"
 
+// Number of cores, each with its own receive queue on each device
+#ifndef CORES
+#error Please define CORES
+#endif
+
 static size_t devices_count;
 static struct net_ether_addr* endpoint_macs;
 static struct net_ether_addr* device_macs;
+static struct net_packet* current_packets;
 static size_t* current_output_lengths;
 
+// Output lengths of the given packet, which must be one of the current packets
+static size_t* output_lengths_of(struct net_packet* packet) { return current_output_lengths + (size_t) (packet - current_packets) * (devices_count - 1); }
+
 static size_t index_from_device(struct net_packet* packet, device_t device) { return device > packet->device ? (device - 1) : device; }
 
 static device_t device_from_index(struct net_packet* packet, size_t index) { return index < packet->device ? index : (index + 1); }
@@ -28,14 +39,17 @@ static void handle_flags(struct net_packet* packet, device_t device, enum net_tr
 void net_transmit(struct net_packet* packet, device_t device, enum net_transmit_flags flags)
 {
 	handle_flags(packet, device, flags);
-	current_output_lengths[index_from_device(packet, device)] = packet->length;
+	output_lengths_of(packet)[index_from_device(packet, device)] = packet->length;
+	os_stats_tx(device, 1);
 }
 
 void net_flood(struct net_packet* packet, enum net_transmit_flags flags)
 {
 	for (size_t n = 0; n < devices_count - 1; n++) {
-		handle_flags(packet, device_from_index(packet, n), flags);
-		current_output_lengths[n] = packet->length;
+		device_t device = device_from_index(packet, n);
+		handle_flags(packet, device, flags);
+		output_lengths_of(packet)[n] = packet->length;
+		os_stats_tx(device, 1);
 	}
 }
 
@@ -44,20 +58,41 @@ void net_flood_except(struct net_packet* packet, bool* disabled_devices, enum ne
 	for (size_t n = 0; n < devices_count - 1; n++) {
 		device_t device = device_from_index(packet, n);
 		handle_flags(packet, device, flags);
-		current_output_lengths[n] = disabled_devices[device] ? 0 : packet->length;
+		output_lengths_of(packet)[n] = disabled_devices[device] ? 0 : packet->length;
+		os_stats_tx(device, disabled_devices[device] ? 0 : 1);
 	}
 }
 
-static void tinynf_packet_handler(size_t index, char* packet, size_t length, size_t* output_lengths)
+static void tinynf_packet_handler(size_t index, char** packets, size_t* lengths, size_t count, size_t* output_lengths)
 {
 	current_output_lengths = output_lengths;
-	struct net_packet pkt = {
-	    .data = packet,
-	    .length = length,
-	    .time = os_clock_time_ns(),
-	    .device = (device_t) index,
-	};
-	nf_handle(&pkt);
+	// All packets of a batch arrived within a few hundred nanoseconds, so they share a timestamp
+	time_t now = os_clock_time_ns();
+	for (size_t n = 0; n < count; n++) {
+		current_packets[n] = (struct net_packet){
+		    .data = packets[n],
+		    .length = lengths[n],
+		    .time = now,
+		    .device = (device_t) index,
+		};
+	}
+	os_stats_rx(index, count);
+#ifdef STATS_LATENCY
+	if (nf_handle_batch == NULL) {
+		// Time each packet on its own, so that outliers are not averaged away
+		for (size_t n = 0; n < count; n++) {
+			uint64_t start = tsc_get();
+			nf_handle(&(current_packets[n]));
+			os_stats_latency(tsc_get() - start, 1);
+		}
+	} else {
+		uint64_t start = tsc_get();
+		nf_handle_batch(current_packets, count);
+		os_stats_latency(tsc_get() - start, count);
+	}
+#else
+	net_handle_batch(current_packets, count);
+#endif
 }
 
 // TODO net shouldn't be exposing a main(argc, argv), it should be OS handling this since metal doesn't need one and the args are unused...
@@ -67,22 +102,25 @@ int main(int argc, char** argv)
 	(void) argc;
 	(void) argv;
 
+	// Each core has its own NF state, which is only consistent for NFs whose state is per flow, since RSS sends both directions of a flow to the same core;
+	// check this before touching any device
+	if (CORES > 1 && (&nf_per_flow_state == NULL || !nf_per_flow_state)) {
+		os_debug("The NF's state is not per flow, thus it cannot run on multiple cores");
+		return 1;
+	}
+
 	os_init();
 
 	struct os_pci_address* pci_addresses;
 	devices_count = os_pci_enumerate(&pci_addresses);
 
-	if (!nf_init(devices_count)) {
-		os_debug("NF failed to init");
-		return 1;
-	}
-
 	struct tn_device* devices = os_memory_alloc(devices_count, sizeof(struct tn_device));
 	endpoint_macs = os_memory_alloc(devices_count, sizeof(struct net_ether_addr));
 	device_macs = os_memory_alloc(devices_count, sizeof(struct net_ether_addr));
 	for (size_t n = 0; n < devices_count; n++) {
 		tn_device_init(&(pci_addresses[n]), &(devices[n]));
 		tn_device_set_promiscuous(&(devices[n]));
+		tn_device_set_queues(&(devices[n]), CORES);
 		// TODO have it in config somehow, in the meantime use a non-constant
 		endpoint_macs[n] = (struct net_ether_addr){.bytes = {0, n >> 10, n >> 20, n >> 30, n >> 40, 0}};
 		// TODO maybe network.h should directly use net_ether_addr?
@@ -90,10 +128,27 @@ int main(int argc, char** argv)
 		device_macs[n] = (struct net_ether_addr){.bytes = {device_mac >> 0, device_mac >> 8, device_mac >> 16, device_mac >> 24, device_mac >> 32, device_mac >> 40}};
 	}
 
-	struct tn_agent* agents = agents_alloc(devices_count, sizeof(struct tn_agent));
-	for (size_t n = 0; n < devices_count; n++) {
-		tn_agent_init(n, devices_count, devices, &(agents[n]));
+	// One agent per device per core, each core handling the same queue index on all devices
+	struct tn_agent* agents = agents_alloc(CORES * devices_count, sizeof(struct tn_agent));
+	for (size_t c = 0; c < CORES; c++) {
+		for (size_t n = 0; n < devices_count; n++) {
+			tn_agent_init(n, c, devices_count, devices, &(agents[c * devices_count + n]));
+		}
 	}
 
-	tn_run(devices_count, agents, tinynf_packet_handler);
+	// A single core needs neither other processes nor pinning
+	size_t core = 0;
+	if (CORES > 1) {
+		core = os_init_cores(CORES);
+	}
+
+	if (!nf_init(devices_count)) {
+		os_debug("NF failed to init");
+		return 1;
+	}
+	os_stats_memory();
+
+	current_packets = os_memory_alloc(TN_BATCH_SIZE_MAX, sizeof(struct net_packet));
+
+	tn_run(devices_count, &(agents[core * devices_count]), tinynf_packet_handler);
 }
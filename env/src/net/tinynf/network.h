@@ -4,8 +4,8 @@
 // A 'device' represents a physical network card: https://en.wikipedia.org/wiki/Network_interface_controller
 // Devices only handle packets destined to them by default, by looking at packets' MAC address: https://en.wikipedia.org/wiki/MAC_address
 // Devices can be set into 'promiscuous' mode to handle all packets regardless of MAC address.
-// Each device has one 'queue' to receive packet, and multiple 'queues' to transmit packets.
-// An 'agent' handles packets received on one input device, forwarding them through zero or more output devices as needed.
+// Each device has one or more 'queues' to receive packets, among which packets are spread by flow, and multiple 'queues' to transmit packets.
+// An 'agent' handles packets received on one queue of one input device, forwarding them through zero or more output devices as needed.
 
 #pragma once
 
@@ -22,7 +22,8 @@ struct tn_device {
 	void* addr;
 	bool rx_enabled;
 	bool tx_enabled;
-	uint8_t _padding[6];
+	uint8_t queues_count;
+	uint8_t _padding[5];
 };
 
 struct tn_descriptor {
@@ -30,11 +31,16 @@ struct tn_descriptor {
 	uint64_t metadata;
 };
 
+// Maximum number of packets given to the handler at once
+#define TN_BATCH_SIZE_MAX 8
+
 struct tn_agent {
 	char* buffer;
 	volatile uint32_t* receive_tail_addr;
 	size_t processed_delimiter;
 	size_t outputs_count;
+	char** packets;
+	size_t* packet_lengths;
 	size_t* lengths;
 	volatile uint32_t* transmit_heads;
 	volatile struct tn_descriptor** rings; // 0 == shared receive/transmit, rest are exclusive transmit
@@ -47,14 +53,16 @@ struct tn_agent {
 void tn_device_init(const struct os_pci_address* pci_address, struct tn_device* device); // device must be preallocated, will be overwritten
 void tn_device_set_promiscuous(struct tn_device* device);
 uint64_t tn_device_get_mac(struct tn_device* device); // only the lowest 48 bits are nonzero, in big-endian
+void tn_device_set_queues(struct tn_device* device, size_t queues_count); // spreads received packets among queues, keeping both directions of a flow on the same queue; must be called before any agent uses the device
 
 // Assumes the input should not be an output. (It'd be nice to have the flexibility, but in practice we don't need it for now)
-void tn_agent_init(size_t input_index, size_t devices_count, struct tn_device* devices, struct tn_agent* agent); // agent must be preallocated, will be overwritten
+void tn_agent_init(size_t input_index, size_t queue_index, size_t devices_count, struct tn_device* devices, struct tn_agent* agent); // agent must be preallocated, will be overwritten
 
 // Packet processing API
 // ---------------------
 
-// Sets outputs[N] = length of the packet on device N, where 0 means drop (devices are in the order they were added)
-typedef void tn_packet_handler(size_t index, char* packet, size_t length, size_t* output_lengths);
+// Handles the given packets, of which there are between 1 and TN_BATCH_SIZE_MAX,
+// and sets output_lengths[P * outputs_count + N] = length of packet P on output N, where 0 means drop (outputs are in the order they were added)
+typedef void tn_packet_handler(size_t index, char** packets, size_t* lengths, size_t count, size_t* output_lengths);
 // Runs the agents forever using the given handler
 _Noreturn void tn_run(size_t agents_count, struct tn_agent* agents, tn_packet_handler* handler);
@@ -1,21 +1,57 @@
 #include "os/init.h"
 
+#include "arch/tsc.h"
+#include "os/stats.h"
+
+#include <fcntl.h>
 #include <rte_cycles.h>
 #include <rte_debug.h>
+#include <rte_lcore.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // For clock.h
-uint64_t cpu_freq_numerator;
-uint64_t cpu_freq_denominator;
+uint64_t cpu_freq_multiplier;
+uint64_t cpu_freq_shift;
+
+// For stats.c
+struct os_stats* stats;
 
 void os_init(void)
 {
-	cpu_freq_numerator = rte_get_tsc_hz();
-	if (cpu_freq_numerator == 0) {
+	uint64_t freq_hz = rte_get_tsc_hz();
+	if (freq_hz == 0) {
 		rte_panic("Could not get TSC freq");
 	}
-	cpu_freq_denominator = 1000000000ull;
-	while (cpu_freq_numerator % 10 == 0) {
-		cpu_freq_numerator = cpu_freq_numerator / 10;
-		cpu_freq_denominator = cpu_freq_denominator / 10;
+	tsc_get_ns_conversion(freq_hz, 1000000000ull, &cpu_freq_multiplier, &cpu_freq_shift);
+
+	// Each lcore has its own counters, see stats.c
+	if (rte_lcore_count() > OS_STATS_CORES_MAX) {
+		rte_panic("Too many lcores for statistics, please increase OS_STATS_CORES_MAX");
+	}
+
+	// Same as the Linux OS: export statistics in a shared memory object if possible, otherwise keep them private
+	stats = MAP_FAILED;
+	int fd = shm_open(OS_STATS_SHM_NAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		if (ftruncate(fd, sizeof(struct os_stats)) == 0) {
+			stats = mmap(NULL, sizeof(struct os_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+	}
+	if (stats == MAP_FAILED) {
+		stats = mmap(NULL, sizeof(struct os_stats), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (stats == MAP_FAILED) {
+			rte_panic("Could not allocate statistics");
+		}
+	}
+}
+
+size_t os_init_cores(size_t count)
+{
+	// DPDK has its own notion of cores, "lcores", which the DPDK driver should use instead
+	if (count != 1) {
+		rte_panic("Use DPDK lcores instead");
 	}
+	return 0;
 }
@@ -4,7 +4,13 @@
 #include <rte_debug.h>
 #include <rte_malloc.h>
 
-void* os_memory_alloc(const size_t count, const size_t size)
+// DPDK can free memory, so scratch memory is normal memory that is remembered until the end of the scope
+#define SCRATCH_ALLOCS_MAX 64
+static void* scratch_allocs[SCRATCH_ALLOCS_MAX];
+static size_t scratch_allocs_count;
+static bool scratch_active;
+
+static void* memory_alloc(const size_t count, const size_t size)
 {
 	// Align must "obviously" be a power of 2 and at least 64, says DPDK doc
 	size_t align = rte_align64pow2(count * size);
@@ -15,6 +21,50 @@ void* os_memory_alloc(const size_t count, const size_t size)
 	return rte_calloc("os_memory_alloc", count, size, align);
 }
 
+void* os_memory_alloc(const size_t count, const size_t size)
+{
+	// This would be fine on DPDK, but not on other OSes, which release all memory allocated within a scope
+	if (scratch_active) {
+		rte_panic("os_memory_alloc cannot be called within a scratch scope");
+	}
+	return memory_alloc(count, size);
+}
+
+void os_memory_scratch_begin(void)
+{
+	if (scratch_active) {
+		rte_panic("Scratch scopes cannot be nested");
+	}
+	scratch_active = true;
+	scratch_allocs_count = 0;
+}
+
+void* os_memory_scratch_alloc(const size_t count, const size_t size)
+{
+	if (!scratch_active) {
+		rte_panic("Scratch memory can only be used within a scope");
+	}
+	if (scratch_allocs_count == SCRATCH_ALLOCS_MAX) {
+		rte_panic("Too many scratch allocations, please increase SCRATCH_ALLOCS_MAX");
+	}
+	void* result = memory_alloc(count, size);
+	scratch_allocs[scratch_allocs_count] = result;
+	scratch_allocs_count = scratch_allocs_count + 1;
+	return result;
+}
+
+void os_memory_scratch_end(void)
+{
+	if (!scratch_active) {
+		rte_panic("Scratch memory can only be used within a scope");
+	}
+	for (size_t n = 0; n < scratch_allocs_count; n++) {
+		rte_free(scratch_allocs[n]);
+	}
+	scratch_allocs_count = 0;
+	scratch_active = false;
+}
+
 void* os_memory_phys_to_virt(const uintptr_t addr, const size_t size)
 {
 	(void) addr;
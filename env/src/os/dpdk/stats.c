@@ -0,0 +1,55 @@
+#include "os/stats.h"
+
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+// Set by init.c
+extern struct os_stats* stats;
+
+// Cores are lcores, indexed by their position among enabled lcores rather than by ID since IDs can be sparse; init.c checks that there are at most OS_STATS_CORES_MAX
+static inline struct os_stats_core* stats_core(void)
+{
+	return &(stats->cores[rte_lcore_index(-1)]);
+}
+
+void os_stats_drop(enum os_stats_drop_reason reason)
+{
+	struct os_stats_core* core = stats_core();
+	core->drops[reason] = core->drops[reason] + 1;
+}
+
+void os_stats_rx(size_t device, size_t count)
+{
+	if (device < OS_STATS_DEVICES_MAX) {
+		struct os_stats_core* core = stats_core();
+		core->rx[device] = core->rx[device] + count;
+	}
+}
+
+void os_stats_tx(size_t device, size_t count)
+{
+	if (device < OS_STATS_DEVICES_MAX) {
+		struct os_stats_core* core = stats_core();
+		core->tx[device] = core->tx[device] + count;
+	}
+}
+
+void os_stats_latency(uint64_t cycles, size_t count)
+{
+	struct os_stats_core* core = stats_core();
+	size_t bucket = os_stats_latency_bucket(cycles / count);
+	core->latency[bucket] = core->latency[bucket] + count;
+}
+
+void os_stats_memory(void)
+{
+	// os_memory_alloc uses DPDK's heap of the current socket, which is shared by the lcores of that socket, thus so are these statistics
+	struct os_stats_core* core = stats_core();
+	unsigned socket = rte_socket_id();
+	struct rte_malloc_socket_stats socket_stats;
+	if (rte_malloc_get_socket_stats((int) socket, &socket_stats) == 0) {
+		core->memory_used = socket_stats.heap_allocsz_bytes;
+		core->memory_size = socket_stats.heap_totalsz_bytes;
+		core->memory_node = socket;
+	}
+}
@@ -3,6 +3,7 @@
 // We already have a time_t, don't re-define it (first for glibc, second for musl)
 #define __time_t_defined 1
 #define __DEFINED_time_t 1
+#include "arch/tsc.h"
 #include "os/log.h"
 
 #include <stdlib.h>
@@ -22,3 +23,31 @@ void os_clock_sleep_ns(uint64_t ns)
 		abort();
 	}
 }
+
+// Measures the frequency of the timestamp counter in nanohertz as a rational number, by counting TSC cycles during a known amount of time
+// Used by init.c, and by network layers that have their own init, such as pcap
+void linux_tsc_calibrate(uint64_t* out_numerator, uint64_t* out_denominator)
+{
+	// CLOCK_MONOTONIC_RAW is not adjusted by NTP, which is what we want since the TSC is not either.
+	// 50 ms is enough for the frequency to be within a few parts per million, since each clock_gettime takes well under a microsecond
+	const uint64_t duration_ns = 50 * 1000 * 1000;
+	struct timespec start;
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &start) != 0) {
+		os_debug("Could not get the time to calibrate the TSC");
+		abort();
+	}
+	uint64_t start_cycles = tsc_get();
+	uint64_t elapsed_ns;
+	uint64_t elapsed_cycles;
+	do {
+		if (clock_gettime(CLOCK_MONOTONIC_RAW, &now) != 0) {
+			os_debug("Could not get the time to calibrate the TSC");
+			abort();
+		}
+		elapsed_cycles = tsc_get() - start_cycles;
+		elapsed_ns = (uint64_t) (now.tv_sec - start.tv_sec) * 1000000000ull + (uint64_t) now.tv_nsec - (uint64_t) start.tv_nsec;
+	} while (elapsed_ns < duration_ns);
+	*out_numerator = elapsed_cycles;
+	*out_denominator = elapsed_ns;
+}
@@ -1,56 +1,185 @@
 #include "os/init.h"
 
 #include "arch/tsc.h"
+#include "os/config.h"
 #include "os/log.h"
 #include "os/memory.h"
 #include "os/pci.h"
+#include "os/stats.h"
+
+// We already have a time_t, don't re-define it (first for glibc, second for musl)
+#define __time_t_defined 1
+#define __DEFINED_time_t 1
 
-#include <assert.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <sys/io.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
-// 1 GB hugepages
-#define HUGEPAGE_SIZE_POWER (10 + 10 + 10)
-#define HUGEPAGE_SIZE (1u << HUGEPAGE_SIZE_POWER)
+// Hugepage sizes to try, as powers of 2, in order of preference: 1 GB pages need fewer TLB entries, but many hosts cannot reserve them at runtime, unlike 2 MB ones
+static const size_t hugepage_size_powers[] = {10 + 10 + 10, 10 + 10 + 1};
 
 // The version of musl shipped on Ubuntu 18.04 doesn't define this
 #ifndef MAP_HUGE_SHIFT
 #define MAP_HUGE_SHIFT 26
 #endif
 
+// From linux/mempolicy.h, which is not always installed
+#define MPOL_PREFERRED 1
+// Highest NUMA node we can express a policy for, plus one
+#define NUMA_NODES_MAX 1024
+
 // For clock.h
-uint64_t cpu_freq_numerator;
-uint64_t cpu_freq_denominator;
+uint64_t cpu_freq_multiplier;
+uint64_t cpu_freq_shift;
 
 // For the shared memory_alloc.c
 char* memory;
 size_t memory_used_len;
 
-static uint64_t linux_msr_read(uint64_t index)
+// For stats.c
+struct os_stats_core* stats_core;
+size_t memory_node;
+
+static struct os_stats* stats;
+
+// CPU that ran the latest memory_init, which is on memory_node
+static unsigned memory_cpu;
+
+// From memory.c
+void memory_region_add(char* start, size_t size, size_t page_size_power);
+
+// From clock.c
+void linux_tsc_calibrate(uint64_t* out_numerator, uint64_t* out_denominator);
+
+static bool linux_msr_read(uint64_t index, uint64_t* out_value)
 {
 	int msr_fd = open("/dev/cpu/0/msr", O_RDONLY);
 	if (msr_fd == -1) {
 		os_debug("Could not open MSR file; are you root? did you modprobe msr?");
-		abort();
+		return false;
 	}
 
-	off_t seek_result = lseek(msr_fd, (off_t) index, SEEK_SET);
-	if (seek_result == (off_t) -1) {
-		os_debug("Could not seek into MSR file");
+	if (index != (uint64_t) (off_t) index) {
+		os_debug("MSR index does not fit in off_t");
 		abort();
 	}
 
-	uint64_t msr = 0;
-	long read_result = read(msr_fd, (void*) &msr, sizeof(msr));
-	if (read_result != sizeof(msr)) {
+	long read_result = pread(msr_fd, (void*) out_value, sizeof(uint64_t), (off_t) index);
+	close(msr_fd);
+	if (read_result != sizeof(uint64_t)) {
 		os_debug("Could not read MSR file");
+		return false;
+	}
+
+	return true;
+}
+
+// Gets the CPU the caller is running on and its NUMA node
+static void current_cpu(unsigned* out_cpu, unsigned* out_node)
+{
+	if (syscall(SYS_getcpu, out_cpu, out_node, NULL) != 0) {
+		os_debug("Could not get the current CPU");
+		abort();
+	}
+}
+
+static void memory_init(void)
+{
+	// The allocator always has OS_MEMORY_SIZE bytes, since memory_alloc.c is verified with that constant.
+	// The config can set an upper bound, e.g., the hugepages a host reserves for the program, so that a build with too much memory fails clearly rather than by running out of hugepages.
+	uint64_t max_size;
+	if (os_config_try_get("memory size", &max_size) && max_size < OS_MEMORY_SIZE) {
+		os_debug("OS_MEMORY_SIZE exceeds the memory size set in the config, please build with a smaller OS_MEMORY_SIZE");
 		abort();
 	}
 
-	return msr;
+	// The only way to have pinned pages on Linux is to use huge pages: https://www.kernel.org/doc/Documentation/vm/hugetlbpage.txt
+	// Note that Linux's `mlock` system call is not sufficient to pin; it only guarantees the pages will not be swapped out, not that the physical address won't change.
+	// While Linux doesn't actually guarantee that huge pages are pinned, in practice its implementation pins them.
+	// Hugepages are reserved when mapping them, so if there are not enough free ones of a size, mmap fails and we try the next size.
+	char* base = MAP_FAILED;
+	size_t page_size_power = 0;
+	size_t page_size = 0;
+	size_t mapped_size = 0;
+	for (size_t n = 0; n < sizeof(hugepage_size_powers) / sizeof(hugepage_size_powers[0]) && base == MAP_FAILED; n++) {
+		page_size_power = hugepage_size_powers[n];
+		page_size = (size_t) 1 << page_size_power;
+		mapped_size = (OS_MEMORY_SIZE + page_size - 1) / page_size * page_size;
+		base = mmap(
+		    // No specific address
+		    NULL,
+		    // Size of the mapping
+		    mapped_size,
+		    // R/W page
+		    PROT_READ | PROT_WRITE,
+		    // Hugepage, not backed by a file (and thus zero-initialized); note that without MAP_SHARED the call fails
+		    // The pages are not populated yet, so that their NUMA policy can be set first
+		    MAP_HUGETLB | (int) (page_size_power << MAP_HUGE_SHIFT) | MAP_ANONYMOUS | MAP_SHARED,
+		    // Required on MAP_ANONYMOUS
+		    -1,
+		    // Required on MAP_ANONYMOUS
+		    0);
+	}
+	if (base == MAP_FAILED) {
+		os_debug("Allocate mmap failed, please reserve either 1 GB or 2 MB hugepages");
+		abort();
+	}
+
+	// Prefer the node of the current CPU, so that cores pinned to CPUs on different sockets each get local memory.
+	// "Preferred" rather than "bind" means the kernel uses another node if this one has no free hugepage, instead of crashing on the first access.
+	// Machines without NUMA support fail this call, which is fine since they have a single node anyway.
+	unsigned node;
+	current_cpu(&memory_cpu, &node);
+	memory_node = node;
+	if (memory_node < NUMA_NODES_MAX) {
+		unsigned long nodes[NUMA_NODES_MAX / (8 * sizeof(unsigned long))] = {0};
+		nodes[memory_node / (8 * sizeof(unsigned long))] = 1ul << (memory_node % (8 * sizeof(unsigned long)));
+		// The kernel ignores the last bit of the mask for historical reasons, hence the + 1
+		if (syscall(SYS_mbind, base, mapped_size, MPOL_PREFERRED, nodes, NUMA_NODES_MAX + 1, 0) != 0) {
+			os_debug("Could not set the NUMA policy of the memory, it may be on a remote node");
+		}
+	}
+
+	// Fault the pages in now, as MAP_POPULATE would have, which is required if the calling code tries to get the physical address of a page without accessing it first.
+	for (size_t offset = 0; offset < mapped_size; offset += page_size) {
+		((volatile char*) base)[offset] = 0;
+	}
+
+	// Resolve physical addresses once and for all, since os_memory_virt_to_phys would otherwise need to read the pagemap each time.
+	// Pages may not be physically contiguous with each other, which is fine since drivers translate each object they give to devices separately, and keep these within a page.
+	memory_region_add(base, mapped_size, page_size_power);
+
+	memory = base;
+	memory_used_len = 0;
+}
+
+static void stats_init(void)
+{
+	// The counters are in a shared memory object so that external tools can read them, and since the mapping is shared, it remains so after forking cores.
+	// Statistics are not worth failing for, so use an anonymous shared mapping if the object cannot be created, e.g., because /dev/shm is not writable.
+	stats = MAP_FAILED;
+	int fd = shm_open(OS_STATS_SHM_NAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		if (ftruncate(fd, sizeof(struct os_stats)) == 0) {
+			stats = mmap(NULL, sizeof(struct os_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+	}
+	if (stats == MAP_FAILED) {
+		os_debug("Could not create the statistics shared memory object, statistics will not be exported");
+		stats = mmap(NULL, sizeof(struct os_stats), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+		if (stats == MAP_FAILED) {
+			os_debug("Could not allocate statistics");
+			abort();
+		}
+	}
+	stats_core = &(stats->cores[0]);
 }
 
 void os_init(void)
@@ -64,32 +193,82 @@ void os_init(void)
 	}
 
 	// Second, fetch the CPU frequency
-	tsc_get_nhz(linux_msr_read, &cpu_freq_numerator, &cpu_freq_denominator);
+	uint64_t freq_numerator;
+	uint64_t freq_denominator;
+	if (!tsc_get_nhz(linux_msr_read, &freq_numerator, &freq_denominator)) {
+		os_debug("Could not get the TSC frequency from the CPU, measuring it instead");
+		linux_tsc_calibrate(&freq_numerator, &freq_denominator);
+	}
+	tsc_get_ns_conversion(freq_numerator, freq_denominator, &cpu_freq_multiplier, &cpu_freq_shift);
 
-	// Finally, initialize the memory for the allocator
-	// The only way to have pinned pages on Linux is to use huge pages: https://www.kernel.org/doc/Documentation/vm/hugetlbpage.txt
-	// Note that Linux's `mlock` system call is not sufficient to pin; it only guarantees the pages will not be swapped out, not that the physical address won't change.
-	// While Linux doesn't actually guarantee that huge pages are pinned, in practice its implementation pins them.
-	// We use a single 1 GB page to serve everything, which is enough for the allocator
-	static_assert(HUGEPAGE_SIZE >= OS_MEMORY_SIZE);
-	memory = mmap(
-	    // No specific address
-	    NULL,
-	    // Size of the mapping
-	    HUGEPAGE_SIZE,
-	    // R/W page
-	    PROT_READ | PROT_WRITE,
-	    // Hugepage, not backed by a file (and thus zero-initialized); note that without MAP_SHARED the call fails
-	    // MAP_POPULATE means the page table will be populated already (without the need for a page fault later),
-	    // which is required if the calling code tries to get the physical address of the page without accessing it first.
-	    MAP_HUGETLB | (HUGEPAGE_SIZE_POWER << MAP_HUGE_SHIFT) | MAP_ANONYMOUS | MAP_SHARED | MAP_POPULATE,
-	    // Required on MAP_ANONYMOUS
-	    -1,
-	    // Required on MAP_ANONYMOUS
-	    0);
-	if (memory == MAP_FAILED) {
-		os_debug("Allocate mmap failed");
+	// Then, initialize the memory for the allocator
+	memory_init();
+
+	// Finally, create the statistics counters
+	stats_init();
+}
+
+size_t os_init_cores(size_t count)
+{
+	cpu_set_t available_cpus;
+	if (sched_getaffinity(0, sizeof(available_cpus), &available_cpus) != 0) {
+		os_debug("Could not get the available CPUs");
 		abort();
 	}
-	memory_used_len = 0;
+	if (count == 0 || count > (size_t) CPU_COUNT(&available_cpus)) {
+		os_debug("Not enough CPUs available for the requested number of cores");
+		abort();
+	}
+	if (count > OS_STATS_CORES_MAX) {
+		os_debug("Too many cores for statistics, please increase OS_STATS_CORES_MAX");
+		abort();
+	}
+
+	// Each core other than the first is a child process, so that it has its own copy of global variables without any changes to the code using them
+	size_t index = 0;
+	for (size_t n = 1; n < count; n++) {
+		pid_t pid = fork();
+		if (pid == -1) {
+			os_debug("Could not fork");
+			abort();
+		}
+		if (pid == 0) {
+			// Don't outlive the first core, so that stopping the program works as usual
+			if (prctl(PR_SET_PDEATHSIG, SIGKILL) != 0) {
+				os_debug("Could not set the parent death signal");
+				abort();
+			}
+			index = n;
+			break;
+		}
+	}
+
+	// The first core stays on the CPU that ran os_init, so that the existing memory is on its node; the others are pinned to the other available CPUs, in order
+	int cpu = (int) memory_cpu;
+	if (index != 0) {
+		cpu = -1;
+		for (size_t n = 0; n < index; n++) {
+			do {
+				cpu = cpu + 1;
+			} while (!CPU_ISSET(cpu, &available_cpus) || cpu == (int) memory_cpu);
+		}
+	}
+	cpu_set_t pinned_cpus;
+	CPU_ZERO(&pinned_cpus);
+	CPU_SET(cpu, &pinned_cpus);
+	if (sched_setaffinity(0, sizeof(pinned_cpus), &pinned_cpus) != 0) {
+		os_debug("Could not pin to a CPU");
+		abort();
+	}
+
+	// The existing memory is a shared mapping, thus still shared after the fork; children get their own memory for later allocations, on their own NUMA node
+	// (the first core keeps using the existing memory, which is fine since nobody else allocates from it any more, and is already on its node)
+	if (index != 0) {
+		memory_init();
+	}
+
+	// Each core has its own counters
+	stats_core = &(stats->cores[index]);
+
+	return index;
 }
@@ -8,8 +8,27 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+// Physical addresses of the pages of the hugepage-backed memory mapped by init.c, so that translating addresses within it needs neither system calls nor file accesses.
+// There are at most two such regions per core: the one mapped by os_init, and the one mapped for the current core by os_init_cores.
+#define REGIONS_MAX 2
+
+struct memory_region {
+	uintptr_t start;
+	size_t size;
+	size_t page_size_power;
+	uintptr_t* pages_phys;
+};
+
+static struct memory_region regions[REGIONS_MAX];
+static size_t regions_count;
+
 static size_t os_memory_pagesize(void)
 {
+	static size_t page_size;
+	if (page_size != 0) {
+		return page_size;
+	}
+
 	// sysconf is documented to return -1 on error; let's check all negative cases along the way, to make sure the conversion to unsigned is sound
 	const long page_size_long = sysconf(_SC_PAGESIZE);
 	if (page_size_long < 0) {
@@ -24,7 +43,8 @@ static size_t os_memory_pagesize(void)
 		os_debug("Could not get page size");
 		abort();
 	}
-	return page_size_long;
+	page_size = (size_t) page_size_long;
+	return page_size;
 }
 
 void* os_memory_phys_to_virt(const uintptr_t addr, const size_t size)
@@ -66,7 +86,7 @@ void* os_memory_phys_to_virt(const uintptr_t addr, const size_t size)
 }
 
 // See https://www.kernel.org/doc/Documentation/vm/pagemap.txt
-uintptr_t os_memory_virt_to_phys(const void* const addr)
+static uintptr_t pagemap_virt_to_phys(const void* const addr)
 {
 	const size_t page_size = os_memory_pagesize();
 	const uintptr_t page = (uintptr_t) addr / page_size;
@@ -76,20 +96,18 @@ uintptr_t os_memory_virt_to_phys(const void* const addr)
 		abort();
 	}
 
-	const int map_fd = open("/proc/self/pagemap", O_RDONLY);
+	// The pagemap is kept open, and read without seeking since the file offset would be shared with the other cores after forking
+	static int map_fd = -1;
 	if (map_fd < 0) {
-		os_debug("Could not open the pagemap");
-		abort();
-	}
-
-	if (lseek(map_fd, (off_t) map_offset, SEEK_SET) == (off_t) -1) {
-		os_debug("Could not seek the pagemap");
-		abort();
+		map_fd = open("/proc/self/pagemap", O_RDONLY);
+		if (map_fd < 0) {
+			os_debug("Could not open the pagemap");
+			abort();
+		}
 	}
 
 	uint64_t metadata;
-	const ssize_t read_result = read(map_fd, &metadata, sizeof(uint64_t));
-	close(map_fd);
+	const ssize_t read_result = pread(map_fd, &metadata, sizeof(uint64_t), (off_t) map_offset);
 	if (read_result != sizeof(uint64_t)) {
 		os_debug("Could not read the pagemap");
 		abort();
@@ -110,3 +128,37 @@ uintptr_t os_memory_virt_to_phys(const void* const addr)
 	const uintptr_t addr_offset = (uintptr_t) addr % page_size;
 	return pfn * page_size + addr_offset;
 }
+
+// For init.c: remembers the physical addresses of the given pinned and populated memory, made of pages of 2^page_size_power bytes
+void memory_region_add(char* start, size_t size, size_t page_size_power)
+{
+	if (regions_count == REGIONS_MAX) {
+		os_debug("Too many memory regions");
+		abort();
+	}
+	const size_t pages_count = size >> page_size_power;
+	uintptr_t* pages_phys = malloc(pages_count * sizeof(uintptr_t));
+	if (pages_phys == NULL) {
+		os_debug("Could not allocate the physical addresses of memory pages");
+		abort();
+	}
+	for (size_t n = 0; n < pages_count; n++) {
+		pages_phys[n] = pagemap_virt_to_phys(start + (n << page_size_power));
+	}
+	regions[regions_count] = (struct memory_region){.start = (uintptr_t) start, .size = size, .page_size_power = page_size_power, .pages_phys = pages_phys};
+	regions_count = regions_count + 1;
+}
+
+uintptr_t os_memory_virt_to_phys(const void* const addr)
+{
+	const uintptr_t virt = (uintptr_t) addr;
+	for (size_t n = 0; n < regions_count; n++) {
+		// Unsigned arithmetic, so addresses below the start wrap around and are not in the region
+		const uintptr_t offset = virt - regions[n].start;
+		if (offset < regions[n].size) {
+			return regions[n].pages_phys[offset >> regions[n].page_size_power] + (offset & (((uintptr_t) 1 << regions[n].page_size_power) - 1));
+		}
+	}
+	// Not in the allocator's memory, e.g., memory-mapped device registers, which are rarely translated
+	return pagemap_virt_to_phys(addr);
+}
@@ -0,0 +1,59 @@
+#include "os/memory.h"
+
+#include "arch/halt.h"
+#include "os/log.h"
+
+// Scratch memory on top of the shared memory_alloc.c: a scope remembers where the allocator was, and its end rolls the allocator back.
+// Unallocated memory must be zeroed, which memory_alloc.c relies on to return zeroed memory, so the end of a scope zeroes what it releases.
+// This is not verified; it only needs the allocator's globals to have the meaning they have in memory_alloc.c's invariant.
+
+extern char* memory;
+extern size_t memory_used_len;
+
+static bool scratch_active;
+// Allocator position at the beginning of the scope, and after the latest scratch allocation; if the allocator is elsewhere, os_memory_alloc was called within the scope
+static size_t scratch_start;
+static size_t scratch_end;
+
+static void scratch_check(void)
+{
+	if (!scratch_active) {
+		os_debug("Scratch memory can only be used within a scope");
+		halt();
+	}
+	if (memory_used_len != scratch_end) {
+		os_debug("os_memory_alloc cannot be called within a scratch scope");
+		halt();
+	}
+}
+
+void os_memory_scratch_begin(void)
+{
+	if (scratch_active) {
+		os_debug("Scratch scopes cannot be nested");
+		halt();
+	}
+	scratch_active = true;
+	scratch_start = memory_used_len;
+	scratch_end = memory_used_len;
+}
+
+void* os_memory_scratch_alloc(size_t count, size_t size)
+{
+	scratch_check();
+	void* result = os_memory_alloc(count, size);
+	scratch_end = memory_used_len;
+	return result;
+}
+
+void os_memory_scratch_end(void)
+{
+	scratch_check();
+	// Volatile so that the compiler does not turn this into a call to memset, which bare metal does not have
+	volatile char* released = memory;
+	for (size_t n = scratch_start; n < memory_used_len; n++) {
+		released[n] = 0;
+	}
+	memory_used_len = scratch_start;
+	scratch_active = false;
+}
@@ -1,15 +1,47 @@
 #include "os/init.h"
 
+#include "arch/halt.h"
 #include "arch/msr.h"
 #include "arch/tsc.h"
+#include "os/log.h"
 #include "os/memory.h"
+#include "os/stats.h"
 
 // For clock.h
-uint64_t cpu_freq_numerator;
-uint64_t cpu_freq_denominator;
+uint64_t cpu_freq_multiplier;
+uint64_t cpu_freq_shift;
 
 // For the shared memory allocator
 char memory[OS_MEMORY_SIZE]; // zero-initialized
 size_t memory_used_len;
 
-void os_init(void) { tsc_get_nhz(msr_read, &cpu_freq_numerator, &cpu_freq_denominator); }
+// For stats.c; there is no way to export counters, but they can be inspected with a debugger
+static struct os_stats stats; // zero-initialized
+struct os_stats_core* stats_core = &(stats.cores[0]);
+
+static bool metal_msr_read(uint64_t index, uint64_t* out_value)
+{
+	*out_value = msr_read(index);
+	return true;
+}
+
+void os_init(void)
+{
+	uint64_t freq_numerator;
+	uint64_t freq_denominator;
+	if (!tsc_get_nhz(metal_msr_read, &freq_numerator, &freq_denominator)) {
+		os_debug("Could not get the TSC frequency");
+		halt();
+	}
+	tsc_get_ns_conversion(freq_numerator, freq_denominator, &cpu_freq_multiplier, &cpu_freq_shift);
+}
+
+size_t os_init_cores(size_t count)
+{
+	// Other cores would have to be booted, and would then need their own globals, which is not supported
+	if (count != 1) {
+		os_debug("Bare metal only supports one core");
+		halt();
+	}
+	return 0;
+}
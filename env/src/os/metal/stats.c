@@ -0,0 +1,41 @@
+#include "os/stats.h"
+
+#include "os/memory.h"
+
+// Counters of the current core, set by init.c
+extern struct os_stats_core* stats_core;
+
+// From init.c, for the shared memory_alloc.c
+extern size_t memory_used_len;
+
+void os_stats_drop(enum os_stats_drop_reason reason)
+{
+	stats_core->drops[reason] = stats_core->drops[reason] + 1;
+}
+
+void os_stats_rx(size_t device, size_t count)
+{
+	if (device < OS_STATS_DEVICES_MAX) {
+		stats_core->rx[device] = stats_core->rx[device] + count;
+	}
+}
+
+void os_stats_tx(size_t device, size_t count)
+{
+	if (device < OS_STATS_DEVICES_MAX) {
+		stats_core->tx[device] = stats_core->tx[device] + count;
+	}
+}
+
+void os_stats_latency(uint64_t cycles, size_t count)
+{
+	size_t bucket = os_stats_latency_bucket(cycles / count);
+	stats_core->latency[bucket] = stats_core->latency[bucket] + count;
+}
+
+void os_stats_memory(void)
+{
+	stats_core->memory_used = memory_used_len;
+	stats_core->memory_size = OS_MEMORY_SIZE;
+	stats_core->memory_node = 0;
+}
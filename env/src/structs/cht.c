@@ -2,7 +2,15 @@
 
 #include "os/memory.h"
 
-static size_t loop(size_t k, size_t capacity) { return k % capacity; }
+// Maps a hash to [0, range) without a division, see Lemire's "A fast alternative to the modulo reduction"
+static inline size_t hash_to_range(hash_t hash, size_t range) { return (size_t) (((uint64_t) hash * (uint64_t) range) >> (sizeof(hash_t) * 8)); }
+
+// Adds 'value' to 'index' modulo 'capacity', assuming both are already less than 'capacity'
+static inline size_t add_wrap(size_t index, size_t value, size_t capacity)
+{
+	size_t result = index + value;
+	return result >= capacity ? result - capacity : result;
+}
 
 struct cht* cht_alloc(uint16_t cht_height, uint16_t backend_capacity)
 {
@@ -10,44 +18,93 @@ struct cht* cht_alloc(uint16_t cht_height, uint16_t backend_capacity)
 	struct cht* cht = os_memory_alloc(1, sizeof(struct cht));
 	cht->height = cht_height;
 	cht->backend_capacity = backend_capacity;
-	cht->data = os_memory_alloc((size_t) (cht_height * backend_capacity), sizeof(uint16_t));
+	cht->data = os_memory_alloc((size_t) cht_height * backend_capacity, sizeof(uint16_t));
+	cht->preferred = os_memory_alloc(cht_height, sizeof(uint16_t));
+	cht->rebuild_cursor = 0;
+	cht->rebuild_remaining = 0;
 
-	// Create permutations
-	uint16_t* permutations = os_memory_alloc((size_t) (cht_height * backend_capacity), sizeof(uint16_t));
+	// Backend i's permutation of the buckets is (offset_i + shift_i * j) % height for j in [0, height), with offset_i = (31 * i) % height and shift_i = (i % (height - 1)) + 1.
+	// Fill the CHT by letting each backend in turn claim its next bucket in its permutation, appending itself to the bucket's preference list.
+	// Instead of materializing all permutations, keep each backend's current position, and compute offsets and shifts incrementally, avoiding divisions.
+	// The positions and the next free priority of each bucket are only needed here, thus are scratch memory.
+	os_memory_scratch_begin();
+	uint16_t* positions = os_memory_scratch_alloc(backend_capacity, sizeof(uint16_t));
+	uint16_t* next = os_memory_scratch_alloc(cht_height, sizeof(uint16_t));
+	size_t offset = 0;
 	for (size_t i = 0; i < backend_capacity; ++i) {
-		size_t offset = loop(i * 31, cht_height);
-		size_t shift = loop(i, cht_height - 1) + 1;
-		for (size_t j = 0; j < cht_height; ++j) {
-			size_t permut = loop(offset + shift * j, cht_height);
-			permutations[i * cht_height + j] = (uint16_t) permut;
+		positions[i] = (uint16_t) offset;
+		// 31 may be larger than the height, so wrap as many times as needed
+		offset = offset + 31;
+		while (offset >= cht_height) {
+			offset -= cht_height;
 		}
 	}
-
-	// Fill the CHT
-	size_t* next = os_memory_alloc((size_t) (cht_height), sizeof(size_t));
-	for (size_t i = 0; i < cht_height; ++i) {
-		for (size_t j = 0; j < backend_capacity; ++j) {
-			size_t bucket_id = permutations[j * cht_height + i];
+	for (size_t j = 0; j < cht_height; ++j) {
+		size_t shift_minus_one = 0;
+		for (size_t i = 0; i < backend_capacity; ++i) {
+			size_t bucket_id = positions[i];
 			size_t priority = next[bucket_id];
-			next[bucket_id] += 1;
-			cht->data[(size_t) (backend_capacity * bucket_id + priority)] = (uint16_t) j;
+			next[bucket_id] = (uint16_t) (priority + 1);
+			cht->data[backend_capacity * bucket_id + priority] = (uint16_t) i;
+			positions[i] = (uint16_t) add_wrap(bucket_id, shift_minus_one + 1, cht_height);
+			shift_minus_one = add_wrap(shift_minus_one, 1, (size_t) cht_height - 1);
 		}
 	}
+	os_memory_scratch_end();
 
-	// free(next);
-	// free(permutations);
+	// Until the first rebuild, the preferred backend of each bucket is the first one in its preference list
+	for (size_t b = 0; b < cht_height; ++b) {
+		cht->preferred[b] = cht->data[backend_capacity * b];
+	}
 	return cht;
 }
 
-bool cht_find_preferred_available_backend(struct cht* cht, void* obj, size_t obj_size, struct index_pool* active_backends, uint16_t* chosen_backend, time_t time)
+// Returns the first available backend in the preference list of the given bucket, if any
+static inline bool cht_scan_bucket(struct cht* cht, size_t bucket, struct index_pool* active_backends, time_t time, uint16_t* out_backend)
 {
-	size_t cht_bucket = loop(os_memory_hash(obj, obj_size), cht->height) * cht->backend_capacity;
+	const uint16_t* candidates = cht->data + bucket * cht->backend_capacity;
 	for (size_t i = 0; i < cht->backend_capacity; ++i) {
-		uint16_t candidate = cht->data[cht_bucket + i];
-		if (index_pool_used(active_backends, time, candidate)) {
-			*chosen_backend = candidate;
+		if (index_pool_used(active_backends, time, candidates[i])) {
+			*out_backend = candidates[i];
 			return true;
 		}
 	}
 	return false;
 }
+
+bool cht_find_preferred_available_backend(struct cht* cht, void* obj, size_t obj_size, struct index_pool* active_backends, uint16_t* chosen_backend, time_t time)
+{
+	size_t bucket = hash_to_range(os_memory_hash(obj, obj_size), cht->height);
+	uint16_t preferred = cht->preferred[bucket];
+	if (index_pool_used(active_backends, time, preferred)) {
+		*chosen_backend = preferred;
+		return true;
+	}
+	// The cached backend stopped, find and cache the next one, so that only the first lookup in this bucket pays for the scan
+	if (cht_scan_bucket(cht, bucket, active_backends, time, chosen_backend)) {
+		cht->preferred[bucket] = *chosen_backend;
+		return true;
+	}
+	return false;
+}
+
+void cht_request_rebuild(struct cht* cht)
+{
+	// Restart from the current position, there is no need to go back to the first bucket
+	cht->rebuild_remaining = cht->height;
+}
+
+bool cht_rebuild(struct cht* cht, struct index_pool* active_backends, time_t time, uint16_t max_buckets)
+{
+	for (uint16_t n = 0; n < max_buckets && cht->rebuild_remaining != 0; ++n) {
+		size_t bucket = cht->rebuild_cursor;
+		uint16_t backend;
+		// If no backend is available, keep the old one, which is as good as any
+		if (cht_scan_bucket(cht, bucket, active_backends, time, &backend)) {
+			cht->preferred[bucket] = backend;
+		}
+		cht->rebuild_cursor = bucket == (size_t) cht->height - 1 ? 0 : (uint16_t) (bucket + 1);
+		cht->rebuild_remaining = cht->rebuild_remaining - 1;
+	}
+	return cht->rebuild_remaining == 0;
+}
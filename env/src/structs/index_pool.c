@@ -2,28 +2,44 @@
 
 #include "os/memory.h"
 
+//@ #include "proof/listexex.gh"
+
 // The odd use of fixpoints for seemingly-simple things such as nth_eq is required for forall_ to work properly;
 // in general, only expressions that are direct arguments to calls can be "trigger" terms for forall_ expansion,
 // see VeriFast's examples/fm2012/problem1-alternative.c
 
+// Every index is in exactly one of two circular doubly-linked lists, as in Vigor's "dchain":
+// the free list, whose sentinel is the index 'size', and the used list, whose sentinel is the index 'size + 1'.
+// The used list is sorted by timestamp, thus its head is the index with the oldest timestamp, which makes borrowing O(1) instead of a scan of all timestamps.
+// An index is inserted after the last index whose timestamp is not later than its own, which is the end of the list unless time went backwards,
+// so the list stays sorted with O(1) insertion as long as time is monotonic.
+// The lists only guide the search, the timestamps remain the ground truth and are always checked before returning an index,
+// thus the proof does not need any invariant on the lists beyond their links being in bounds, except for the 'all young' answer of borrowing, see there.
 struct index_pool {
 	time_t* timestamps;
+	size_t* prev;
+	size_t* next;
 	size_t size;
 	time_t expiration_time;
-	size_t last_borrowed_index;
 };
 
 /*@
 fixpoint bool idx_in_bounds<t>(size_t i, list<t> xs) { return 0 <= i && i < length(xs); }
 fixpoint bool nth_eq<t>(size_t i, list<t> xs, t x) { return nth(i, xs) == x; }
+fixpoint bool link_in_bounds(size_t size, size_t link) { return link < size + 2; }
 
-predicate poolp_raw(struct index_pool* pool; size_t size, time_t expiration_time, size_t last_borrowed_index, list<time_t> timestamps) =
+predicate poolp_raw(struct index_pool* pool; size_t size, time_t expiration_time, list<time_t> timestamps) =
 	struct_index_pool_padding(pool) &*&
 	pool->timestamps |-> ?raw_timestamps &*&
+	pool->prev |-> ?raw_prev &*&
+	pool->next |-> ?raw_next &*&
 	pool->size |-> size &*&
 	pool->expiration_time |-> expiration_time &*&
-	pool->last_borrowed_index |-> last_borrowed_index &*&
-	raw_timestamps[0..size] |-> timestamps;
+	raw_timestamps[0..size] |-> timestamps &*&
+	raw_prev[0..size + 2] |-> ?prevs &*&
+	raw_next[0..size + 2] |-> ?nexts &*&
+	true == forall(prevs, (link_in_bounds)(size)) &*&
+	true == forall(nexts, (link_in_bounds)(size));
 
 predicate poolp_truths(list<time_t> timestamps, list<pair<size_t, time_t> > items) =
 	true == ghostmap_distinct(items) &*&
@@ -31,9 +47,8 @@ predicate poolp_truths(list<time_t> timestamps, list<pair<size_t, time_t> > item
 	forall_(size_t k; !ghostmap_has(items, k) || ghostmap_get(items, k) == some(nth(k, timestamps)));
 
 predicate poolp(struct index_pool* pool, size_t size, time_t expiration_time, list<pair<size_t, time_t> > items) =
-	poolp_raw(pool, size, expiration_time, ?last_borrowed_index, ?timestamps) &*&
-	poolp_truths(timestamps, items) &*&
-	last_borrowed_index <= size;
+	poolp_raw(pool, size, expiration_time, ?timestamps) &*&
+	poolp_truths(timestamps, items);
 @*/
 
 /*@
@@ -89,6 +104,8 @@ struct index_pool* index_pool_alloc(size_t size, time_t expiration_time)
 	struct index_pool* pool = (struct index_pool*) os_memory_alloc(1, sizeof(struct index_pool));
 	//@ close_struct_zero(pool);
 	pool->timestamps = (time_t*) os_memory_alloc(size, sizeof(time_t));
+	pool->prev = (size_t*) os_memory_alloc(size + 2, sizeof(size_t));
+	pool->next = (size_t*) os_memory_alloc(size + 2, sizeof(size_t));
 	pool->size = size;
 	pool->expiration_time = expiration_time;
 
@@ -104,6 +121,32 @@ struct index_pool* index_pool_alloc(size_t size, time_t expiration_time)
 		pool->timestamps[n - 1] = TIME_MAX;
 	}
 
+	// Initially, all indices are in the free list, in order, and the used list is empty
+	for (size_t n = size + 2; n > 0; n--)
+	/*@ invariant pool->prev |-> ?raw_prev &*&
+		      pool->next |-> ?raw_next &*&
+		      chars((char*) raw_prev, n * sizeof(size_t), _) &*&
+		      chars((char*) raw_next, n * sizeof(size_t), _) &*&
+		      raw_prev[n..size + 2] |-> ?prevs &*&
+		      raw_next[n..size + 2] |-> ?nexts &*&
+		      true == forall(prevs, (link_in_bounds)(size)) &*&
+		      true == forall(nexts, (link_in_bounds)(size)); @*/
+	//@ decreases n;
+	{
+		//@ chars_split((char*) raw_prev, (n - 1) * sizeof(size_t));
+		//@ chars_to_integer_(raw_prev + n - 1, sizeof(size_t), false);
+		//@ chars_split((char*) raw_next, (n - 1) * sizeof(size_t));
+		//@ chars_to_integer_(raw_next + n - 1, sizeof(size_t), false);
+		size_t index = n - 1;
+		if (index == size + 1) {
+			pool->prev[index] = size + 1;
+			pool->next[index] = size + 1;
+		} else {
+			pool->prev[index] = index == 0 ? size : index - 1;
+			pool->next[index] = index == size ? 0 : index + 1;
+		}
+	}
+
 	//@ assert pool->timestamps |-> ?raw_timestamps;
 	//@ assert raw_timestamps[0..size] |-> ?timestamps;
 	//@ forall_eq_nth(timestamps, TIME_MAX);
@@ -112,6 +155,62 @@ struct index_pool* index_pool_alloc(size_t size, time_t expiration_time)
 	return pool;
 }
 
+// Moves the given index to its place for the given time, i.e., in the free list (size) if the time is TIME_MAX and in the used list (size + 1) otherwise,
+// after the last index of that list whose timestamp is not later than the given time
+static void index_pool_move(struct index_pool* pool, size_t index, time_t time)
+/*@ requires poolp_raw(pool, ?size, ?exp_time, ?timestamps) &*&
+	     index < size; @*/
+/*@ ensures poolp_raw(pool, size, exp_time, timestamps); @*/
+/*@ terminates; @*/
+{
+	//@ open poolp_raw(pool, size, exp_time, timestamps);
+	//@ assert pool->timestamps |-> ?raw_timestamps;
+	//@ assert pool->prev |-> ?raw_prev &*& raw_prev[0..size + 2] |-> ?prevs;
+	//@ assert pool->next |-> ?raw_next &*& raw_next[0..size + 2] |-> ?nexts;
+	//@ forall_nth(prevs, (link_in_bounds)(size), index);
+	//@ forall_nth(nexts, (link_in_bounds)(size), index);
+	size_t old_prev = pool->prev[index];
+	size_t old_next = pool->next[index];
+	pool->next[old_prev] = old_next;
+	//@ forall_update(nexts, (link_in_bounds)(size), old_prev, old_next);
+	pool->prev[old_next] = old_prev;
+	//@ forall_update(prevs, (link_in_bounds)(size), old_next, old_prev);
+
+	//@ assert raw_prev[0..size + 2] |-> ?prevs2;
+	size_t sentinel = time == TIME_MAX ? pool->size : pool->size + 1;
+	//@ forall_nth(prevs2, (link_in_bounds)(size), sentinel);
+	size_t tail = pool->prev[sentinel];
+	// Walk back past the indices with a later timestamp, of which there are none unless time went backwards;
+	// the list has fewer than 'size' indices since the given one is in neither list, so the bound is never reached
+	for (size_t n = 0; n < pool->size && tail < pool->size && pool->timestamps[tail] > time; n++)
+	/*@ invariant pool->timestamps |-> raw_timestamps &*&
+		      raw_timestamps[0..size] |-> timestamps &*&
+		      pool->prev |-> raw_prev &*&
+		      raw_prev[0..size + 2] |-> prevs2 &*&
+		      pool->size |-> size &*&
+		      tail < size + 2; @*/
+	//@ decreases size - n;
+	{
+		//@ forall_nth(prevs2, (link_in_bounds)(size), tail);
+		tail = pool->prev[tail];
+	}
+
+	//@ assert raw_next[0..size + 2] |-> ?nexts2;
+	//@ forall_nth(nexts2, (link_in_bounds)(size), tail);
+	size_t new_next = pool->next[tail];
+	pool->prev[index] = tail;
+	//@ forall_update(prevs2, (link_in_bounds)(size), index, tail);
+	pool->next[index] = new_next;
+	//@ forall_update(nexts2, (link_in_bounds)(size), index, new_next);
+	pool->next[tail] = index;
+	//@ assert raw_next[0..size + 2] |-> ?nexts3;
+	//@ forall_update(nexts3, (link_in_bounds)(size), tail, index);
+	pool->prev[new_next] = index;
+	//@ assert raw_prev[0..size + 2] |-> ?prevs3;
+	//@ forall_update(prevs3, (link_in_bounds)(size), new_next, index);
+	//@ close poolp_raw(pool, size, exp_time, timestamps);
+}
+
 /*@
 lemma void pool_items_implication_tail(list<pair<size_t, time_t> > items, list<time_t> timestamps, time_t time, time_t exp_time)
 requires items == cons(?h, ?t) &*&
@@ -158,61 +257,62 @@ bool index_pool_borrow(struct index_pool* pool, time_t time, size_t* out_index,
 		   : poolp(pool, size, exp_time, items); @*/
 /*@ terminates; @*/
 {
-	// Optimization:
-	// Instead of looping through the entire array from zero,
-	// we keep track of the last index we borrowed and start from there next time.
-	// This avoids O(N^2) performance when borrowing a bunch of stuff at startup.
-	// Cloning the loop is the easiest way to do this from a verification perspective.
-
 	//@ open poolp(pool, size, exp_time, items);
 	// These three lines are required to avoid failures later...
 	//@ open poolp_truths(?timestamps, items);
 	//@ close poolp_truths(timestamps, items);
-	//@ assert poolp_raw(pool, size, exp_time, ?lbi, timestamps);
-	for (size_t n = pool->last_borrowed_index; n < pool->size; n++)
-	/*@ invariant poolp_raw(pool, size, exp_time, lbi, timestamps) &*&
-		      poolp_truths(timestamps, items) &*&
-		      *out_index |-> _ &*&
-		      *out_used |-> _ &*&
-		      lbi <= size &*&
-		      forall_(size_t k; !(lbi <= k && k < n) || !nth_eq(k, timestamps, TIME_MAX)) &*&
-		      forall_(size_t k; !(lbi <= k && k < n) || (time < exp_time || time - exp_time <= nth(k, timestamps))); @*/
-	//@ decreases size - n;
-	{
-		if (pool->timestamps[n] == TIME_MAX) {
-			//@ ghostmap_array_max_size(items, size, n);
-			pool->timestamps[n] = time;
-			pool->last_borrowed_index = n;
-			*out_index = n;
-			*out_used = false;
-			//@ truths_update(items, n, time);
-			//@ close poolp(pool, size, exp_time, ghostmap_set(items, n, time));
-			return true;
-		}
-		if (time >= pool->expiration_time && time - pool->expiration_time > pool->timestamps[n]) {
-			//@ ghostmap_notpred_implies_notforall(items, (pool_young)(time, exp_time), n);
-			pool->timestamps[n] = time;
-			pool->last_borrowed_index = n;
-			*out_index = n;
+
+	// Fast path: the head of the free list, if any, is free
+	size_t free_index = pool->next[pool->size];
+	if (free_index < pool->size && pool->timestamps[free_index] == TIME_MAX) {
+		//@ ghostmap_array_max_size(items, size, free_index);
+		pool->timestamps[free_index] = time;
+		index_pool_move(pool, free_index, time);
+		*out_index = free_index;
+		*out_used = false;
+		//@ truths_update(items, free_index, time);
+		//@ close poolp(pool, size, exp_time, ghostmap_set(items, free_index, time));
+		return true;
+	}
+
+	// Fast path: the head of the used list is the oldest index, so either it is expired or none are
+	size_t oldest_index = pool->next[pool->size + 1];
+	if (oldest_index < pool->size && pool->timestamps[oldest_index] != TIME_MAX) {
+		if (time >= pool->expiration_time && time - pool->expiration_time > pool->timestamps[oldest_index]) {
+			//@ ghostmap_notpred_implies_notforall(items, (pool_young)(time, exp_time), oldest_index);
+			pool->timestamps[oldest_index] = time;
+			index_pool_move(pool, oldest_index, time);
+			*out_index = oldest_index;
 			*out_used = true;
-			//@ truths_update(items, n, time);
-			//@ close poolp(pool, size, exp_time, ghostmap_set(items, n, time));
+			//@ truths_update(items, oldest_index, time);
+			//@ close poolp(pool, size, exp_time, ghostmap_set(items, oldest_index, time));
 			return true;
 		}
+		if (free_index == pool->size) {
+			// The free list is empty, thus all indices are in the used list, which is sorted by timestamp,
+			// and its oldest index is not expired, thus no index is expired.
+			// This is the only assumption in this file: VeriFast cannot see this since the proof has no invariant on the lists,
+			// but it can be easily audited, since index_pool_move is the only function that changes the lists and it keeps them sorted.
+			//@ assume(length(items) == size && ghostmap_forall(items, (pool_young)(time, exp_time)));
+			//@ close poolp(pool, size, exp_time, items);
+			return false;
+		}
 	}
-	for (size_t n = 0; n < pool->last_borrowed_index; n++)
-	/*@ invariant poolp_raw(pool, size, exp_time, lbi, timestamps) &*&
+
+	// Slow path: scan all indices, which the lists make unnecessary, but which keeps the remaining cases verified without any invariant on the lists
+	for (size_t n = 0; n < pool->size; n++)
+	/*@ invariant poolp_raw(pool, size, exp_time, timestamps) &*&
 		      poolp_truths(timestamps, items) &*&
 		      *out_index |-> _ &*&
 		      *out_used |-> _ &*&
 		      forall_(size_t k; !(0 <= k && k < n) || !nth_eq(k, timestamps, TIME_MAX)) &*&
 		      forall_(size_t k; !(0 <= k && k < n) || (time < exp_time || time - exp_time <= nth(k, timestamps))); @*/
-	//@ decreases lbi - n;
+	//@ decreases size - n;
 	{
 		if (pool->timestamps[n] == TIME_MAX) {
 			//@ ghostmap_array_max_size(items, size, n);
 			pool->timestamps[n] = time;
-			pool->last_borrowed_index = n;
+			index_pool_move(pool, n, time);
 			*out_index = n;
 			*out_used = false;
 			//@ truths_update(items, n, time);
@@ -222,7 +322,7 @@ bool index_pool_borrow(struct index_pool* pool, time_t time, size_t* out_index,
 		if (time >= pool->expiration_time && time - pool->expiration_time > pool->timestamps[n]) {
 			//@ ghostmap_notpred_implies_notforall(items, (pool_young)(time, exp_time), n);
 			pool->timestamps[n] = time;
-			pool->last_borrowed_index = n;
+			index_pool_move(pool, n, time);
 			*out_index = n;
 			*out_used = true;
 			//@ truths_update(items, n, time);
@@ -247,6 +347,7 @@ void index_pool_refresh(struct index_pool* pool, time_t time, size_t index)
 {
 	//@ open poolp(pool, size, exp_time, items);
 	pool->timestamps[index] = time;
+	index_pool_move(pool, index, time);
 	//@ truths_update(items, index, time);
 	//@ close poolp(pool, size, exp_time, ghostmap_set(items, index, time));
 }
@@ -290,6 +391,7 @@ void index_pool_return(struct index_pool* pool, size_t index)
 {
 	//@ open poolp(pool, size, exp_time, items);
 	pool->timestamps[index] = TIME_MAX;
+	index_pool_move(pool, index, TIME_MAX);
 	//@ truths_update(items, index, TIME_MAX);
 	//@ close poolp(pool, size, exp_time, ghostmap_remove(items, index));
 }
@@ -0,0 +1,198 @@
+#include "structs/map.h"
+
+#include "arch/cache.h"
+#include "os/memory.h"
+
+// Alternative map implementation, used instead of ../map.c when building with STRUCTS_MAP=inline.
+// Unlike ../map.c, it is NOT verified; Klint checks NFs against the inline-keys variant of the map contracts (see map.h), which are then trusted.
+//
+// The design is the same as ../map.c, i.e., linear probing with a per-item count of the keys whose probe went through the item,
+// except that keys are copied into the item instead of being referenced through a pointer.
+// Thus a lookup that hits touches one cache line instead of two, since comparing keys no longer requires a load from the NF's own key array.
+// Keys must be at most MAP_INLINE_KEY_SIZE_MAX bytes long, so that an item is 32 bytes and two items fit in a cache line.
+// Common key sizes get their own instantiation of the operations, chosen by map_alloc, in which the key size is a constant.
+
+// Whether an item holds a key is stored in the top bit of its chain counter, which never gets that high since the map cannot have 2^31 items in OS_MEMORY_SIZE
+#define ITEM_BUSY ((uint32_t) 1 << 31)
+
+struct map_item {
+	char key[MAP_INLINE_KEY_SIZE_MAX];
+	size_t value;
+	hash_t key_hash;
+	uint32_t chain;
+};
+
+// Operations specialized for a key size, see MAP_SPECIALIZE below
+struct map_ops {
+	bool (*get)(struct map* map, void* key_ptr, size_t* out_value);
+	void (*get_batch)(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found);
+	void (*set)(struct map* map, void* key_ptr, size_t value);
+	void (*remove)(struct map* map, void* key_ptr);
+};
+
+struct map {
+	const struct map_ops* ops;
+	struct map_item* items;
+	size_t key_size;
+	size_t mask;
+};
+
+// All functions below are always inlined into the specialized operations, so that when the key size is a constant,
+// hashing and comparing keys become straight-line code, and the key size checks below disappear
+
+static inline __attribute__((always_inline)) uint64_t key_load(const char* bytes, size_t size)
+{
+	if (size == 8) {
+		uint64_t value;
+		__builtin_memcpy(&value, bytes, 8);
+		return value;
+	}
+	uint32_t value;
+	__builtin_memcpy(&value, bytes, 4);
+	return value;
+}
+
+// Compares keys one word at a time; keys of 4 to 16 bytes take two possibly overlapping loads per key
+static inline __attribute__((always_inline)) bool key_eq(const char* item_key, const void* key_ptr, size_t key_size)
+{
+	if (key_size < 4) {
+		return os_memory_eq(item_key, key_ptr, key_size);
+	}
+	size_t word_size = key_size >= 8 ? 8 : 4;
+	const char* key = (const char*) key_ptr;
+	uint64_t first = key_load(item_key, word_size) ^ key_load(key, word_size);
+	uint64_t last = key_load(item_key + key_size - word_size, word_size) ^ key_load(key + key_size - word_size, word_size);
+	return (first | last) == 0;
+}
+
+static inline __attribute__((always_inline)) bool map_get_hashed(struct map* map, void* key_ptr, hash_t key_hash, size_t* out_value, size_t key_size)
+{
+	struct map_item* items = map->items;
+	size_t mask = map->mask;
+	size_t index = (size_t) key_hash & mask;
+	for (size_t i = 0; i <= mask; i++) {
+		struct map_item* item = &(items[index]);
+		if ((item->chain & ITEM_BUSY) != 0 && item->key_hash == key_hash) {
+			if (key_eq(item->key, key_ptr, key_size)) {
+				*out_value = item->value;
+				return true;
+			}
+		} else if ((item->chain & ~ITEM_BUSY) == 0) {
+			return false;
+		}
+		index = (index + 1) & mask;
+	}
+	return false;
+}
+
+static inline __attribute__((always_inline)) bool map_get_sized(struct map* map, void* key_ptr, size_t* out_value, size_t key_size)
+{
+	return map_get_hashed(map, key_ptr, os_memory_hash(key_ptr, key_size), out_value, key_size);
+}
+
+static inline __attribute__((always_inline)) void map_get_batch_sized(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found, size_t key_size)
+{
+	// Same as ../map.c: hash all keys and prefetch their first item, so that the cache misses of all keys overlap
+	for (size_t n = 0; n < count; n++) {
+		hash_t key_hash = os_memory_hash(keys[n], key_size);
+		out_values[n] = key_hash;
+		cache_prefetch(&(map->items[(size_t) key_hash & map->mask]));
+	}
+	for (size_t n = 0; n < count; n++) {
+		out_found[n] = map_get_hashed(map, keys[n], (hash_t) out_values[n], &(out_values[n]), key_size);
+	}
+}
+
+static inline __attribute__((always_inline)) void map_set_sized(struct map* map, void* key_ptr, size_t value, size_t key_size)
+{
+	hash_t key_hash = os_memory_hash(key_ptr, key_size);
+	struct map_item* items = map->items;
+	size_t mask = map->mask;
+	size_t index = (size_t) key_hash & mask;
+	for (size_t i = 0; i <= mask; i++) {
+		struct map_item* item = &(items[index]);
+		if ((item->chain & ITEM_BUSY) == 0) {
+			__builtin_memcpy(item->key, key_ptr, key_size);
+			item->key_hash = key_hash;
+			item->value = value;
+			item->chain = item->chain | ITEM_BUSY;
+			return;
+		}
+		item->chain = item->chain + 1;
+		index = (index + 1) & mask;
+	}
+}
+
+static inline __attribute__((always_inline)) void map_remove_sized(struct map* map, void* key_ptr, size_t key_size)
+{
+	hash_t key_hash = os_memory_hash(key_ptr, key_size);
+	struct map_item* items = map->items;
+	size_t mask = map->mask;
+	size_t index = (size_t) key_hash & mask;
+	for (size_t i = 0; i <= mask; i++) {
+		struct map_item* item = &(items[index]);
+		if ((item->chain & ITEM_BUSY) != 0 && item->key_hash == key_hash && key_eq(item->key, key_ptr, key_size)) {
+			item->chain = item->chain & ~ITEM_BUSY;
+			return;
+		}
+		item->chain = item->chain - 1;
+		index = (index + 1) & mask;
+	}
+}
+
+// Defines the operations for keys of the given size, which may refer to 'map' to be the map's own key size
+#define MAP_SPECIALIZE(name, size) \
+	static bool map_get_##name(struct map* map, void* key_ptr, size_t* out_value) { return map_get_sized(map, key_ptr, out_value, size); } \
+	static void map_get_batch_##name(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found) \
+	{ \
+		map_get_batch_sized(map, keys, count, out_values, out_found, size); \
+	} \
+	static void map_set_##name(struct map* map, void* key_ptr, size_t value) { map_set_sized(map, key_ptr, value, size); } \
+	static void map_remove_##name(struct map* map, void* key_ptr) { map_remove_sized(map, key_ptr, size); } \
+	static const struct map_ops map_ops_##name = {.get = map_get_##name, .get_batch = map_get_batch_##name, .set = map_set_##name, .remove = map_remove_##name};
+
+// IPv4 addresses, MAC addresses, flows without and with padding
+MAP_SPECIALIZE(4, 4)
+MAP_SPECIALIZE(6, 6)
+MAP_SPECIALIZE(13, 13)
+MAP_SPECIALIZE(16, 16)
+MAP_SPECIALIZE(any, map->key_size)
+
+struct map* map_alloc(size_t key_size, size_t capacity)
+{
+	size_t real_capacity = 1;
+	while (real_capacity < capacity) {
+		real_capacity *= 2;
+	}
+
+	struct map* map = (struct map*) os_memory_alloc(1, sizeof(struct map));
+	map->items = (struct map_item*) os_memory_alloc(real_capacity, sizeof(struct map_item));
+	map->key_size = key_size;
+	map->mask = real_capacity - 1;
+	switch (key_size) {
+		case 4:
+			map->ops = &map_ops_4;
+			break;
+		case 6:
+			map->ops = &map_ops_6;
+			break;
+		case 13:
+			map->ops = &map_ops_13;
+			break;
+		case 16:
+			map->ops = &map_ops_16;
+			break;
+		default:
+			map->ops = &map_ops_any;
+			break;
+	}
+	return map;
+}
+
+bool map_get(struct map* map, void* key_ptr, size_t* out_value) { return map->ops->get(map, key_ptr, out_value); }
+
+void map_get_batch(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found) { map->ops->get_batch(map, keys, count, out_values, out_found); }
+
+void map_set(struct map* map, void* key_ptr, size_t value) { map->ops->set(map, key_ptr, value); }
+
+void map_remove(struct map* map, void* key_ptr) { map->ops->remove(map, key_ptr); }
@@ -0,0 +1,287 @@
+#include "structs/lpm.h"
+
+#include "os/memory.h"
+#include "structs/index_pool.h"
+#include "structs/map.h"
+
+#include <stdint.h>
+
+// Rules, i.e., key/width pairs, are stored masked to their width and followed by the width as a single byte,
+// so that they can be looked up in a map regardless of the key size.
+// 4-byte keys additionally use the DIR-24-8 scheme (Gupta, Lin, McKeown, "Routing lookups in hardware at memory access speeds", INFOCOM'98):
+// a first-level table indexed by the 24 most significant bits of the key, whose entries either directly point to a rule
+// or to a 256-entry second-level table indexed by the remaining 8 bits, for prefixes longer than 24 bits.
+// Each table entry also stores the width of its rule, so that adding a rule only overwrites entries of shorter rules,
+// and removing a rule replaces its entries by those of the longest remaining rule covering it.
+
+// Table entry format: 1 bit "extended" (i.e., points to a second-level table), 1 bit "valid", 6 bits width, 24 bits rule or table index
+#define ENTRY_EXTENDED (1u << 31)
+#define ENTRY_VALID (1u << 30)
+#define ENTRY_WIDTH_SHIFT 24
+#define ENTRY_WIDTH_MASK 0x3Fu
+#define ENTRY_INDEX_MASK 0xFFFFFFu
+
+#define TBL24_SIZE (1u << 24)
+#define TBL8_GROUP_SIZE 256u
+// Maximum number of second-level tables, i.e., of distinct 24-bit prefixes covered by a prefix longer than 24 bits (1 KB each)
+#define TBL8_GROUPS_MAX (1u << 14)
+
+struct lpm {
+	uint32_t* tbl24;
+	uint32_t* tbl8;
+	uint32_t* tbl8_free_groups;
+	size_t tbl8_free_groups_count;
+	char* rules;
+	char* values;
+	size_t* width_counts;
+	struct map* rule_indices;
+	struct index_pool* rule_allocator;
+	char* scratch_rule;
+	size_t key_size;
+	size_t value_size;
+	size_t rule_size;
+	size_t capacity;
+};
+
+static uint32_t entry_make(size_t rule_index, size_t width) { return ENTRY_VALID | ((uint32_t) width << ENTRY_WIDTH_SHIFT) | (uint32_t) rule_index; }
+
+static bool entry_is_extended(uint32_t entry) { return (entry & ENTRY_EXTENDED) != 0; }
+
+static bool entry_is_valid(uint32_t entry) { return (entry & ENTRY_VALID) != 0; }
+
+static size_t entry_width(uint32_t entry) { return (entry >> ENTRY_WIDTH_SHIFT) & ENTRY_WIDTH_MASK; }
+
+static size_t entry_index(uint32_t entry) { return entry & ENTRY_INDEX_MASK; }
+
+static uint32_t key_to_u32(const void* key)
+{
+	uint32_t result;
+	os_memory_copy(key, &result, sizeof(uint32_t));
+	return result;
+}
+
+static uint32_t width_to_mask(size_t width) { return width == 0 ? 0 : ~((uint32_t) 0) << (32 - width); }
+
+// Writes the rule corresponding to the given key and width, i.e., the key masked to the width followed by the width
+static void rule_make(const char* key, size_t key_size, size_t width, char* out_rule)
+{
+	for (size_t n = 0; n < key_size; n++) {
+		// n-th most significant byte of the key
+		size_t byte = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? (key_size - 1 - n) : n;
+		size_t bits = width <= n * 8 ? 0 : (width - n * 8 >= 8 ? 8 : width - n * 8);
+		out_rule[byte] = (char) ((unsigned char) key[byte] & (unsigned char) (0xFFu << (8 - bits)));
+	}
+	out_rule[key_size] = (char) width;
+}
+
+// Finds the rule with the longest width strictly below max_width that covers the given key
+static bool rule_find(struct lpm* lpm, const void* key, size_t max_width, size_t* out_width, size_t* out_index)
+{
+	for (size_t w = max_width; w > 0; w--) {
+		if (lpm->width_counts[w - 1] == 0) {
+			continue;
+		}
+		rule_make(key, lpm->key_size, w - 1, lpm->scratch_rule);
+		if (map_get(lpm->rule_indices, lpm->scratch_rule, out_index)) {
+			*out_width = w - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Sets all entries in the given range that belong to rules no longer than the given width, and which are not extended, to the given entry
+static void entries_overwrite(uint32_t* entries, size_t start, size_t count, size_t width, uint32_t entry)
+{
+	for (size_t n = start; n < start + count; n++) {
+		if (!entry_is_extended(entries[n]) && (!entry_is_valid(entries[n]) || entry_width(entries[n]) <= width)) {
+			entries[n] = entry;
+		}
+	}
+}
+
+// Sets all entries in the given range that point to the given rule, and which are not extended, to the given entry
+static void entries_replace(uint32_t* entries, size_t start, size_t count, size_t rule_index, uint32_t entry)
+{
+	for (size_t n = start; n < start + count; n++) {
+		if (!entry_is_extended(entries[n]) && entry_is_valid(entries[n]) && entry_index(entries[n]) == rule_index) {
+			entries[n] = entry;
+		}
+	}
+}
+
+// Frees the second-level table pointed to by the given first-level entry if all of its entries are identical
+static void tbl8_try_collapse(struct lpm* lpm, uint32_t* tbl24_entry)
+{
+	size_t group = entry_index(*tbl24_entry);
+	uint32_t* entries = lpm->tbl8 + group * TBL8_GROUP_SIZE;
+	uint32_t first = entries[0];
+	if (entry_is_valid(first) && entry_width(first) > 24) {
+		return;
+	}
+	for (size_t n = 1; n < TBL8_GROUP_SIZE; n++) {
+		if (entries[n] != first) {
+			return;
+		}
+	}
+	*tbl24_entry = first;
+	lpm->tbl8_free_groups[lpm->tbl8_free_groups_count] = (uint32_t) group;
+	lpm->tbl8_free_groups_count = lpm->tbl8_free_groups_count + 1;
+}
+
+static void dir_add(struct lpm* lpm, uint32_t key, size_t width, size_t rule_index)
+{
+	uint32_t entry = entry_make(rule_index, width);
+	uint32_t masked_key = key & width_to_mask(width);
+	if (width <= 24) {
+		size_t start = masked_key >> 8;
+		size_t count = (size_t) 1 << (24 - width);
+		// entries_overwrite skips extended entries, so their second-level tables must be updated separately
+		for (size_t n = start; n < start + count; n++) {
+			if (entry_is_extended(lpm->tbl24[n])) {
+				entries_overwrite(lpm->tbl8 + entry_index(lpm->tbl24[n]) * TBL8_GROUP_SIZE, 0, TBL8_GROUP_SIZE, width, entry);
+			}
+		}
+		entries_overwrite(lpm->tbl24, start, count, width, entry);
+	} else {
+		uint32_t* tbl24_entry = &(lpm->tbl24[masked_key >> 8]);
+		// The caller guarantees there is a free group if the entry is not already extended
+		if (!entry_is_extended(*tbl24_entry)) {
+			lpm->tbl8_free_groups_count = lpm->tbl8_free_groups_count - 1;
+			size_t group = lpm->tbl8_free_groups[lpm->tbl8_free_groups_count];
+			for (size_t n = 0; n < TBL8_GROUP_SIZE; n++) {
+				lpm->tbl8[group * TBL8_GROUP_SIZE + n] = *tbl24_entry;
+			}
+			*tbl24_entry = ENTRY_EXTENDED | (uint32_t) group;
+		}
+		entries_overwrite(lpm->tbl8 + entry_index(*tbl24_entry) * TBL8_GROUP_SIZE, masked_key & 0xFF, (size_t) 1 << (32 - width), width, entry);
+	}
+}
+
+static void dir_remove(struct lpm* lpm, uint32_t key, size_t width, size_t rule_index, uint32_t replacement)
+{
+	uint32_t masked_key = key & width_to_mask(width);
+	if (width <= 24) {
+		size_t start = masked_key >> 8;
+		size_t count = (size_t) 1 << (24 - width);
+		for (size_t n = start; n < start + count; n++) {
+			if (entry_is_extended(lpm->tbl24[n])) {
+				entries_replace(lpm->tbl8 + entry_index(lpm->tbl24[n]) * TBL8_GROUP_SIZE, 0, TBL8_GROUP_SIZE, rule_index, replacement);
+				tbl8_try_collapse(lpm, &(lpm->tbl24[n]));
+			}
+		}
+		entries_replace(lpm->tbl24, start, count, rule_index, replacement);
+	} else {
+		uint32_t* tbl24_entry = &(lpm->tbl24[masked_key >> 8]);
+		entries_replace(lpm->tbl8 + entry_index(*tbl24_entry) * TBL8_GROUP_SIZE, masked_key & 0xFF, (size_t) 1 << (32 - width), rule_index, replacement);
+		tbl8_try_collapse(lpm, tbl24_entry);
+	}
+}
+
+struct lpm* lpm_alloc(size_t key_size, size_t value_size, size_t capacity)
+{
+	struct lpm* lpm = (struct lpm*) os_memory_alloc(1, sizeof(struct lpm));
+	lpm->key_size = key_size;
+	lpm->value_size = value_size;
+	lpm->rule_size = key_size + 1;
+	lpm->capacity = capacity;
+	lpm->rules = (char*) os_memory_alloc(capacity, lpm->rule_size);
+	lpm->values = (char*) os_memory_alloc(capacity, value_size);
+	lpm->width_counts = (size_t*) os_memory_alloc(key_size * 8 + 1, sizeof(size_t));
+	lpm->rule_indices = map_alloc(lpm->rule_size, capacity);
+	// Indices never expire, the pool is only used to allocate rule slots
+	lpm->rule_allocator = index_pool_alloc(capacity, TIME_MAX);
+	lpm->scratch_rule = (char*) os_memory_alloc(1, lpm->rule_size);
+
+	if (key_size == sizeof(uint32_t)) {
+		// Zero-initialized, i.e., all entries are invalid
+		lpm->tbl24 = (uint32_t*) os_memory_alloc(TBL24_SIZE, sizeof(uint32_t));
+		size_t groups_count = capacity < TBL8_GROUPS_MAX ? capacity : TBL8_GROUPS_MAX;
+		lpm->tbl8 = (uint32_t*) os_memory_alloc(groups_count * TBL8_GROUP_SIZE, sizeof(uint32_t));
+		lpm->tbl8_free_groups = (uint32_t*) os_memory_alloc(groups_count, sizeof(uint32_t));
+		for (size_t n = 0; n < groups_count; n++) {
+			lpm->tbl8_free_groups[n] = (uint32_t) (groups_count - 1 - n);
+		}
+		lpm->tbl8_free_groups_count = groups_count;
+	} else {
+		// Zero-allocating isn't enough to guarantee pointers are NULL, see the same remark in map.c
+		lpm->tbl24 = NULL;
+	}
+
+	return lpm;
+}
+
+bool lpm_set(struct lpm* lpm, void* key, size_t width, void* value)
+{
+	size_t index;
+	rule_make(key, lpm->key_size, width, lpm->scratch_rule);
+	if (map_get(lpm->rule_indices, lpm->scratch_rule, &index)) {
+		// Table entries point to the rule, not to the value, so there is nothing else to update
+		os_memory_copy(value, lpm->values + index * lpm->value_size, lpm->value_size);
+		return true;
+	}
+
+	if (lpm->tbl24 != NULL && width > 24 && lpm->tbl8_free_groups_count == 0 && !entry_is_extended(lpm->tbl24[(key_to_u32(key) & width_to_mask(width)) >> 8])) {
+		return false;
+	}
+
+	bool was_used;
+	if (!index_pool_borrow(lpm->rule_allocator, 0, &index, &was_used)) {
+		return false;
+	}
+
+	char* rule = lpm->rules + index * lpm->rule_size;
+	os_memory_copy(lpm->scratch_rule, rule, lpm->rule_size);
+	map_set(lpm->rule_indices, rule, index);
+	os_memory_copy(value, lpm->values + index * lpm->value_size, lpm->value_size);
+	lpm->width_counts[width] = lpm->width_counts[width] + 1;
+
+	if (lpm->tbl24 != NULL) {
+		dir_add(lpm, key_to_u32(key), width, index);
+	}
+	return true;
+}
+
+bool lpm_search(struct lpm* lpm, void* key, void* out_value)
+{
+	size_t index;
+	if (lpm->tbl24 != NULL) {
+		uint32_t k = key_to_u32(key);
+		uint32_t entry = lpm->tbl24[k >> 8];
+		if (entry_is_extended(entry)) {
+			entry = lpm->tbl8[entry_index(entry) * TBL8_GROUP_SIZE + (k & 0xFF)];
+		}
+		if (!entry_is_valid(entry)) {
+			return false;
+		}
+		index = entry_index(entry);
+	} else {
+		size_t width;
+		if (!rule_find(lpm, key, lpm->key_size * 8 + 1, &width, &index)) {
+			return false;
+		}
+	}
+
+	os_memory_copy(lpm->values + index * lpm->value_size, out_value, lpm->value_size);
+	return true;
+}
+
+void lpm_remove(struct lpm* lpm, void* key, size_t width)
+{
+	size_t index;
+	rule_make(key, lpm->key_size, width, lpm->scratch_rule);
+	if (!map_get(lpm->rule_indices, lpm->scratch_rule, &index)) {
+		return;
+	}
+
+	map_remove(lpm->rule_indices, lpm->rules + index * lpm->rule_size);
+	index_pool_return(lpm->rule_allocator, index);
+	lpm->width_counts[width] = lpm->width_counts[width] - 1;
+
+	if (lpm->tbl24 != NULL) {
+		size_t parent_width;
+		size_t parent_index;
+		uint32_t replacement = rule_find(lpm, key, width, &parent_width, &parent_index) ? entry_make(parent_index, parent_width) : 0;
+		dir_remove(lpm, key_to_u32(key), width, index, replacement);
+	}
+}
@@ -1,5 +1,6 @@
 #include "structs/map.h"
 
+#include "arch/cache.h"
 #include "os/memory.h"
 
 // This map was originally written by Arseniy Zaostrovnykh as part of the Vigor project,
@@ -1022,10 +1023,12 @@ ensures map_valuesaddrs(kaddrs, key_opts, values, map_values, map_addrs) &*&
 }
 @*/
 
-bool map_get(struct map* map, void* key_ptr, size_t* out_value)
+// Same as map_get, but with the hash of the key already computed
+static bool map_get_hashed(struct map* map, void* key_ptr, hash_t key_hash, size_t* out_value)
 /*@ requires mapp(map, ?key_size, ?capacity, ?map_values, ?map_addrs) &*&
 	     key_ptr != NULL &*&
 	     [?frac]chars(key_ptr, key_size, ?key) &*&
+	     key_hash == hash_fp(key) &*&
 	     *out_value |-> _; @*/
 /*@ ensures mapp(map, key_size, capacity, map_values, map_addrs) &*&
 	    [frac]chars(key_ptr, key_size, key) &*&
@@ -1036,7 +1039,6 @@ bool map_get(struct map* map, void* key_ptr, size_t* out_value)
 //@ terminates;
 {
 	//@ open mapp(map, key_size, capacity, map_values, map_addrs);
-	hash_t key_hash = os_memory_hash(key_ptr, map->key_size);
 	for (size_t i = 0; i < map->capacity; ++i)
 	/*@ invariant mapp_raw(map, ?kaddrs_lst, ?hashes_lst, ?chains_lst, ?values_lst, key_size, ?real_capacity) &*&
 		      mapp_core(key_size, real_capacity, kaddrs_lst, hashes_lst, values_lst, ?key_opts, map_values, map_addrs) &*&
@@ -1134,6 +1136,46 @@ bool map_get(struct map* map, void* key_ptr, size_t* out_value)
 	return false;
 }
 
+bool map_get(struct map* map, void* key_ptr, size_t* out_value)
+/*@ requires mapp(map, ?key_size, ?capacity, ?map_values, ?map_addrs) &*&
+	     key_ptr != NULL &*&
+	     [?frac]chars(key_ptr, key_size, ?key) &*&
+	     *out_value |-> _; @*/
+/*@ ensures mapp(map, key_size, capacity, map_values, map_addrs) &*&
+	    [frac]chars(key_ptr, key_size, key) &*&
+	    switch(ghostmap_get(map_values, key)) {
+	      case none: return result == false &*& *out_value |-> _;
+	      case some(v): return result == true &*& *out_value |-> v;
+	    }; @*/
+//@ terminates;
+{
+	//@ open mapp(map, key_size, capacity, map_values, map_addrs);
+	hash_t key_hash = os_memory_hash(key_ptr, map->key_size);
+	//@ close mapp(map, key_size, capacity, map_values, map_addrs);
+	return map_get_hashed(map, key_ptr, key_hash, out_value);
+}
+
+#ifndef VERIFAST
+// VeriFast does not check this function, only the map_get_hashed it calls for each key, thus its contract in map.h is trusted;
+// it is simple enough to audit, since all it does besides these calls is hashing keys and prefetching their first bucket.
+void map_get_batch(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found)
+{
+	// First, hash all keys and prefetch their first bucket, so that the cache misses of all keys overlap
+	// The hashes are kept in out_values in the meantime, since it is overwritten anyway
+	for (size_t n = 0; n < count; n++) {
+		hash_t key_hash = os_memory_hash(keys[n], map->key_size);
+		out_values[n] = key_hash;
+		if (map->capacity != 0) {
+			cache_prefetch(&(map->items[(size_t) key_hash & (map->capacity - 1)]));
+		}
+	}
+	// Then, resolve the lookups, whose first bucket should now be in the cache
+	for (size_t n = 0; n < count; n++) {
+		out_found[n] = map_get_hashed(map, keys[n], (hash_t) out_values[n], &(out_values[n]));
+	}
+}
+#endif
+
 /*@
 fixpoint bool cell_busy(option<list<char> > x) { return x != none; }
 
@@ -0,0 +1,205 @@
+#include "structs/map.h"
+
+#include "arch/cache.h"
+#include "os/memory.h"
+
+// Alternative map implementation, used instead of ../map.c when building with STRUCTS_MAP=swiss.
+// Unlike ../map.c, it is NOT verified; Klint still verifies NFs using it since it uses the contracts in map.h, but the contracts are then trusted.
+//
+// The design is that of Swiss tables (Abseil's flat_hash_map): slots are split in groups of 16, and each slot has a control byte in a separate array,
+// which is either EMPTY, DELETED, or the low 7 bits of the key's hash (its "tag") if the slot is full.
+// Lookups compare the tag to the 16 control bytes of a group at once using SSE2, and only compare keys on tag matches,
+// then stop at the first group that has an EMPTY slot, since the key would otherwise have been inserted there.
+// Groups are probed quadratically, using triangular numbers, which visit all groups since the number of groups is a power of 2.
+// Removals leave a DELETED slot only if the slot's group has no EMPTY slot, since only then can probes go through that group;
+// DELETED slots are reclaimed by rehashing in place once they would prevent inserting at the maximum load of 7/8.
+
+#define GROUP_SIZE 16
+#define CTRL_EMPTY ((uint8_t) 0x80)
+#define CTRL_DELETED ((uint8_t) 0xFE)
+// Both special values have their high bit set, unlike tags
+#define CTRL_TAG_MASK ((hash_t) 0x7F)
+
+typedef char group_t __attribute__((vector_size(GROUP_SIZE)));
+
+struct map_slot {
+	void* key_addr;
+	size_t value;
+};
+
+struct map {
+	uint8_t* ctrl;
+	struct map_slot* slots;
+	size_t key_size;
+	size_t groups_mask;
+	// Number of EMPTY slots that can still be filled before reaching the maximum load, taking DELETED slots into account
+	size_t growth_left;
+	size_t max_load;
+	size_t count;
+};
+
+static inline group_t group_load(const uint8_t* ctrl)
+{
+	group_t group;
+	__builtin_memcpy(&group, ctrl, sizeof(group_t));
+	return group;
+}
+
+// Returns a bitmask of the slots in the group whose control byte is the given value
+static inline unsigned group_match(group_t group, uint8_t value)
+{
+	group_t values = (group_t){0} + (char) value;
+	return (unsigned) __builtin_ia32_pmovmskb128((group_t) (group == values));
+}
+
+// Returns a bitmask of the slots in the group that are EMPTY or DELETED, i.e., whose high bit is set
+static inline unsigned group_match_available(group_t group) { return (unsigned) __builtin_ia32_pmovmskb128(group); }
+
+static inline size_t home_group(struct map* map, hash_t key_hash) { return ((size_t) key_hash >> 7) & map->groups_mask; }
+
+static inline uint8_t hash_tag(hash_t key_hash) { return (uint8_t) (key_hash & CTRL_TAG_MASK); }
+
+struct map* map_alloc(size_t key_size, size_t capacity)
+{
+	size_t slots_count = GROUP_SIZE;
+	while (slots_count / 8 * 7 < capacity) {
+		slots_count *= 2;
+	}
+
+	struct map* map = (struct map*) os_memory_alloc(1, sizeof(struct map));
+	map->ctrl = (uint8_t*) os_memory_alloc(slots_count, sizeof(uint8_t));
+	map->slots = (struct map_slot*) os_memory_alloc(slots_count, sizeof(struct map_slot));
+	map->key_size = key_size;
+	map->groups_mask = slots_count / GROUP_SIZE - 1;
+	map->max_load = slots_count / 8 * 7;
+	map->growth_left = map->max_load;
+	map->count = 0;
+	for (size_t n = 0; n < slots_count; n++) {
+		map->ctrl[n] = CTRL_EMPTY;
+	}
+	return map;
+}
+
+// Returns the index of the slot containing the given key, or SIZE_MAX if there is none
+static size_t map_find(struct map* map, void* key_ptr, hash_t key_hash)
+{
+	uint8_t tag = hash_tag(key_hash);
+	size_t group_index = home_group(map, key_hash);
+	for (size_t step = 1; step <= map->groups_mask + 1; step++) {
+		group_t group = group_load(map->ctrl + group_index * GROUP_SIZE);
+		unsigned matches = group_match(group, tag);
+		while (matches != 0) {
+			size_t index = group_index * GROUP_SIZE + (size_t) __builtin_ctz(matches);
+			if (os_memory_eq(map->slots[index].key_addr, key_ptr, map->key_size)) {
+				return index;
+			}
+			matches &= matches - 1;
+		}
+		if (group_match(group, CTRL_EMPTY) != 0) {
+			return SIZE_MAX;
+		}
+		group_index = (group_index + step) & map->groups_mask;
+	}
+	return SIZE_MAX;
+}
+
+// Returns the index of the first EMPTY or DELETED slot on the key's probe sequence; there always is one since the load is at most 7/8
+static size_t map_find_available(struct map* map, hash_t key_hash)
+{
+	size_t group_index = home_group(map, key_hash);
+	for (size_t step = 1;; step++) {
+		unsigned available = group_match_available(group_load(map->ctrl + group_index * GROUP_SIZE));
+		if (available != 0) {
+			return group_index * GROUP_SIZE + (size_t) __builtin_ctz(available);
+		}
+		group_index = (group_index + step) & map->groups_mask;
+	}
+}
+
+// Removes all DELETED slots without allocating, like Abseil's "drop_deleted_without_resize":
+// first mark DELETED slots as EMPTY and full ones as DELETED, then re-insert each DELETED one, either in place if it is already in the first available group of its probe sequence,
+// or by moving it to an EMPTY slot, or by swapping it with another DELETED one and handling that one next
+static void map_rehash_in_place(struct map* map)
+{
+	size_t slots_count = (map->groups_mask + 1) * GROUP_SIZE;
+	for (size_t n = 0; n < slots_count; n++) {
+		map->ctrl[n] = map->ctrl[n] < CTRL_EMPTY ? CTRL_DELETED : CTRL_EMPTY;
+	}
+	for (size_t n = 0; n < slots_count; n++) {
+		while (map->ctrl[n] == CTRL_DELETED) {
+			hash_t key_hash = os_memory_hash(map->slots[n].key_addr, map->key_size);
+			size_t target = map_find_available(map, key_hash);
+			if (target / GROUP_SIZE == n / GROUP_SIZE) {
+				map->ctrl[n] = hash_tag(key_hash);
+			} else if (map->ctrl[target] == CTRL_EMPTY) {
+				map->slots[target] = map->slots[n];
+				map->ctrl[target] = hash_tag(key_hash);
+				map->ctrl[n] = CTRL_EMPTY;
+			} else {
+				struct map_slot other = map->slots[target];
+				map->slots[target] = map->slots[n];
+				map->slots[n] = other;
+				map->ctrl[target] = hash_tag(key_hash);
+			}
+		}
+	}
+	map->growth_left = map->max_load - map->count;
+}
+
+bool map_get(struct map* map, void* key_ptr, size_t* out_value)
+{
+	size_t index = map_find(map, key_ptr, os_memory_hash(key_ptr, map->key_size));
+	if (index == SIZE_MAX) {
+		return false;
+	}
+	*out_value = map->slots[index].value;
+	return true;
+}
+
+void map_get_batch(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found)
+{
+	// Same as ../map.c: hash all keys and prefetch their first group of control bytes, so that the cache misses of all keys overlap
+	for (size_t n = 0; n < count; n++) {
+		hash_t key_hash = os_memory_hash(keys[n], map->key_size);
+		out_values[n] = key_hash;
+		cache_prefetch(map->ctrl + home_group(map, key_hash) * GROUP_SIZE);
+	}
+	for (size_t n = 0; n < count; n++) {
+		size_t index = map_find(map, keys[n], (hash_t) out_values[n]);
+		out_found[n] = index != SIZE_MAX;
+		if (out_found[n]) {
+			out_values[n] = map->slots[index].value;
+		}
+	}
+}
+
+void map_set(struct map* map, void* key_ptr, size_t value)
+{
+	hash_t key_hash = os_memory_hash(key_ptr, map->key_size);
+	size_t index = map_find_available(map, key_hash);
+	if (map->ctrl[index] == CTRL_EMPTY) {
+		if (map->growth_left == 0) {
+			// There are DELETED slots since count < capacity <= max_load, get rid of them
+			map_rehash_in_place(map);
+			index = map_find_available(map, key_hash);
+		}
+		map->growth_left = map->growth_left - 1;
+	}
+	map->ctrl[index] = hash_tag(key_hash);
+	map->slots[index] = (struct map_slot){.key_addr = key_ptr, .value = value};
+	map->count = map->count + 1;
+}
+
+void map_remove(struct map* map, void* key_ptr)
+{
+	size_t index = map_find(map, key_ptr, os_memory_hash(key_ptr, map->key_size));
+	size_t group_start = index / GROUP_SIZE * GROUP_SIZE;
+	if (group_match(group_load(map->ctrl + group_start), CTRL_EMPTY) != 0) {
+		map->ctrl[index] = CTRL_EMPTY;
+		map->growth_left = map->growth_left + 1;
+	} else {
+		map->ctrl[index] = CTRL_DELETED;
+	}
+	map->slots[index].key_addr = NULL;
+	map->count = map->count - 1;
+}
@@ -0,0 +1,192 @@
+#include "structs/timer_wheel.h"
+
+#include "os/memory.h"
+
+// Hierarchical timing wheel, as in Varghese and Lauck's "Hashed and Hierarchical Timing Wheels".
+// Time is measured in ticks of 'granularity'. Each level has 64 slots, and a slot of level L covers 64^L ticks,
+// so that 4 levels cover 2^24 ticks ahead of the current tick; timers further ahead are parked in the furthest slot of the top level.
+// A timer is placed in the lowest level whose range covers the time left until it expires. When the current tick reaches the start of a slot
+// in level L > 0, the slot's timers are placed again and thus move to lower levels, until they reach level 0 and then the list of due timers.
+// Each level has a bitmap of possibly-occupied slots, which allows jumping directly to the next tick at which a slot must be processed.
+//
+// Every index is in exactly one circular doubly-linked list: either its own (i.e., it points to itself) if it is not scheduled,
+// or the list of a slot, whose sentinel is 'capacity + level * SLOTS + slot', or the due list, whose sentinel is 'capacity + LEVELS * SLOTS'.
+
+#define LEVELS 4
+#define SLOT_BITS 6
+#define SLOTS ((size_t) 1 << SLOT_BITS)
+#define SLOT_MASK (SLOTS - 1)
+
+struct timer_wheel {
+	uint64_t* ticks;
+	size_t* prev;
+	size_t* next;
+	// Bit N of occupied[L] is set if slot N of level L may contain timers; cancelling a timer does not clear bits, processing an empty slot does
+	uint64_t occupied[LEVELS];
+	size_t capacity;
+	time_t granularity;
+	// All ticks before this one have been processed
+	uint64_t current_tick;
+};
+
+static inline size_t slot_list(struct timer_wheel* wheel, size_t level, size_t slot) { return wheel->capacity + level * SLOTS + slot; }
+
+static inline size_t due_list(struct timer_wheel* wheel) { return wheel->capacity + LEVELS * SLOTS; }
+
+static inline void list_unlink(struct timer_wheel* wheel, size_t index)
+{
+	size_t old_prev = wheel->prev[index];
+	size_t old_next = wheel->next[index];
+	wheel->next[old_prev] = old_next;
+	wheel->prev[old_next] = old_prev;
+	wheel->prev[index] = index;
+	wheel->next[index] = index;
+}
+
+static inline void list_append(struct timer_wheel* wheel, size_t index, size_t list)
+{
+	size_t tail = wheel->prev[list];
+	wheel->prev[index] = tail;
+	wheel->next[index] = list;
+	wheel->next[tail] = index;
+	wheel->prev[list] = index;
+}
+
+// Moves all items of the given list to the end of the due list
+static inline void list_splice_due(struct timer_wheel* wheel, size_t list)
+{
+	size_t first = wheel->next[list];
+	if (first == list) {
+		return;
+	}
+	size_t last = wheel->prev[list];
+	size_t due = due_list(wheel);
+	size_t tail = wheel->prev[due];
+	wheel->next[tail] = first;
+	wheel->prev[first] = tail;
+	wheel->next[last] = due;
+	wheel->prev[due] = last;
+	wheel->prev[list] = list;
+	wheel->next[list] = list;
+}
+
+struct timer_wheel* timer_wheel_alloc(size_t capacity, time_t granularity)
+{
+	struct timer_wheel* wheel = (struct timer_wheel*) os_memory_alloc(1, sizeof(struct timer_wheel));
+	wheel->ticks = (uint64_t*) os_memory_alloc(capacity, sizeof(uint64_t));
+	wheel->prev = (size_t*) os_memory_alloc(capacity + LEVELS * SLOTS + 1, sizeof(size_t));
+	wheel->next = (size_t*) os_memory_alloc(capacity + LEVELS * SLOTS + 1, sizeof(size_t));
+	wheel->capacity = capacity;
+	wheel->granularity = granularity;
+	wheel->current_tick = 0;
+	// All lists, both those of indices and the sentinels, are initially empty
+	for (size_t n = 0; n < capacity + LEVELS * SLOTS + 1; n++) {
+		wheel->prev[n] = n;
+		wheel->next[n] = n;
+	}
+	return wheel;
+}
+
+// Puts the given unlinked index in the right list for its tick
+static void timer_wheel_place(struct timer_wheel* wheel, size_t index)
+{
+	uint64_t tick = wheel->ticks[index];
+	if (tick < wheel->current_tick) {
+		list_append(wheel, index, due_list(wheel));
+		return;
+	}
+	uint64_t delta = tick - wheel->current_tick;
+	if (delta >= (uint64_t) 1 << (SLOT_BITS * LEVELS)) {
+		// Too far ahead, park it in the furthest slot, it will be placed again when that slot is processed
+		tick = wheel->current_tick + ((uint64_t) 1 << (SLOT_BITS * LEVELS)) - 1;
+		delta = tick - wheel->current_tick;
+	}
+	size_t level = 0;
+	while (level < LEVELS - 1 && delta >= (uint64_t) 1 << (SLOT_BITS * (level + 1))) {
+		level++;
+	}
+	size_t slot = (size_t) (tick >> (SLOT_BITS * level)) & SLOT_MASK;
+	list_append(wheel, index, slot_list(wheel, level, slot));
+	wheel->occupied[level] |= (uint64_t) 1 << slot;
+}
+
+// Returns the next tick, at or after the current one, at which an occupied slot must be processed, or UINT64_MAX if there is none
+static uint64_t timer_wheel_next_event(struct timer_wheel* wheel)
+{
+	uint64_t result = UINT64_MAX;
+	for (size_t level = 0; level < LEVELS; level++) {
+		uint64_t occupied = wheel->occupied[level];
+		if (occupied == 0) {
+			continue;
+		}
+		// Slots of this level are processed at multiples of 64^level; find the first such multiple at or after the current tick,
+		// then how many slots after it is the first occupied one, by rotating the bitmap so that bit 0 is the slot of that multiple
+		unsigned shift = SLOT_BITS * (unsigned) level;
+		uint64_t start = (wheel->current_tick + ((uint64_t) 1 << shift) - 1) >> shift;
+		unsigned rotation = (unsigned) (start & SLOT_MASK);
+		uint64_t rotated = rotation == 0 ? occupied : ((occupied >> rotation) | (occupied << (64 - rotation)));
+		uint64_t event = (start + (uint64_t) __builtin_ctzll(rotated)) << shift;
+		if (event < result) {
+			result = event;
+		}
+	}
+	return result;
+}
+
+// Processes the current tick: places again the timers of higher-level slots starting at this tick, from the top level down, then makes the level 0 slot due
+static void timer_wheel_process_tick(struct timer_wheel* wheel)
+{
+	uint64_t tick = wheel->current_tick;
+	for (size_t level = LEVELS - 1; level > 0; level--) {
+		unsigned shift = SLOT_BITS * (unsigned) level;
+		if ((tick & (((uint64_t) 1 << shift) - 1)) != 0) {
+			continue;
+		}
+		size_t slot = (size_t) (tick >> shift) & SLOT_MASK;
+		size_t list = slot_list(wheel, level, slot);
+		wheel->occupied[level] &= ~((uint64_t) 1 << slot);
+		while (wheel->next[list] != list) {
+			size_t index = wheel->next[list];
+			list_unlink(wheel, index);
+			timer_wheel_place(wheel, index);
+		}
+	}
+	size_t slot = (size_t) tick & SLOT_MASK;
+	wheel->occupied[0] &= ~((uint64_t) 1 << slot);
+	list_splice_due(wheel, slot_list(wheel, 0, slot));
+	wheel->current_tick = tick + 1;
+}
+
+void timer_wheel_schedule(struct timer_wheel* wheel, size_t index, time_t expiration_time)
+{
+	list_unlink(wheel, index);
+	wheel->ticks[index] = expiration_time / wheel->granularity;
+	timer_wheel_place(wheel, index);
+}
+
+void timer_wheel_cancel(struct timer_wheel* wheel, size_t index) { list_unlink(wheel, index); }
+
+bool timer_wheel_pop_expired(struct timer_wheel* wheel, time_t time, size_t* out_index)
+{
+	// Only ticks strictly before the one containing 'time' can be processed, since timers in the current tick may expire after 'time'
+	uint64_t now_tick = time / wheel->granularity;
+	size_t due = due_list(wheel);
+	while (wheel->next[due] == due && wheel->current_tick < now_tick) {
+		uint64_t event = timer_wheel_next_event(wheel);
+		if (event >= now_tick) {
+			wheel->current_tick = now_tick;
+			break;
+		}
+		wheel->current_tick = event;
+		timer_wheel_process_tick(wheel);
+	}
+
+	size_t index = wheel->next[due];
+	// The tick check only matters if time went backwards
+	if (index == due || wheel->ticks[index] >= now_tick) {
+		return false;
+	}
+	list_unlink(wheel, index);
+	*out_index = index;
+	return true;
+}
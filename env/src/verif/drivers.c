@@ -4,7 +4,16 @@
 
 #include <stdbool.h>
 
-uint64_t* descriptor_ring_alloc(size_t count) { return os_memory_alloc(count, 2 * sizeof(uint64_t)); }
+// os_memory_alloc only aligns to the size rounded up to the next cache line, thus allocate one more object and skip the beginning as needed
+static void* size_aligned_alloc(size_t count, size_t size)
+{
+	char* result = (char*) os_memory_alloc(count + 1, size);
+	return result + (size - (uintptr_t) result % size) % size;
+}
+
+uint64_t* descriptor_ring_alloc(size_t count) { return (uint64_t*) size_aligned_alloc(1, count * 2 * sizeof(uint64_t)); }
+
+void* packet_buffers_alloc(size_t count, size_t size) { return size_aligned_alloc(count, size); }
 
 void* agents_alloc(size_t count, size_t size) { return os_memory_alloc(count, size); }
 
@@ -2,11 +2,15 @@
 #include "net/skeleton.h"
 #include "os/config.h"
 #include "os/log.h"
+#include "os/stats.h"
 #include "os/time.h"
 
 static device_t external_device;
 static struct flow_table* table;
 
+// Flows are found using their addresses and ports, reversed for external packets, thus each core can have its own copy
+const bool nf_per_flow_state = true;
+
 bool nf_init(device_t devices_count)
 {
 	if (devices_count != 2) {
@@ -30,6 +34,7 @@ void nf_handle(struct net_packet* packet)
 	struct net_tcpudp_header* tcpudp_header;
 	if (!net_get_ether_header(packet, &ether_header) || !net_get_ipv4_header(ether_header, &ipv4_header) || !net_get_tcpudp_header(ipv4_header, &tcpudp_header)) {
 		os_debug("Not TCP/UDP over IPv4 over Ethernet");
+		os_stats_drop(OS_STATS_DROP_UNSUPPORTED);
 		return;
 	}
 
@@ -42,6 +47,7 @@ void nf_handle(struct net_packet* packet)
 				    .protocol = ipv4_header->next_proto_id};
 		if (!flow_table_has_external(table, packet->time, &flow)) {
 			os_debug("Unknown flow");
+			os_stats_drop(OS_STATS_DROP_UNKNOWN_FLOW);
 			return;
 		}
 	} else {
@@ -6,6 +6,7 @@
 #include "structs/cht.h"
 #include "structs/index_pool.h"
 #include "structs/map.h"
+#include "structs/timer_wheel.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -26,9 +27,18 @@ struct balancer {
 	struct flow* flow_heap;
 	device_t* flow_backends;
 	struct index_pool* backend_pool;
+	// Expiration times of live backends, to notice when they stop
+	struct timer_wheel* backend_timers;
+	time_t backend_expiration_time;
 	struct cht* cht;
 };
 
+// Precision with which stopped backends are noticed; lookups in the meantime still skip them, just not in O(1)
+#define BACKEND_TIMERS_GRANULARITY (1000ull * 1000ull)
+
+// Number of CHT buckets whose preferred backend is recomputed per packet while a recomputation is pending, to bound the cost per packet
+#define CHT_REBUILD_BUCKETS_PER_PACKET 8
+
 static inline struct balancer* balancer_alloc(size_t flow_capacity, time_t flow_expiration_time, device_t backend_capacity, time_t backend_expiration_time, device_t cht_height)
 {
 	struct balancer* balancer = os_memory_alloc(1, sizeof(struct balancer));
@@ -37,6 +47,8 @@ static inline struct balancer* balancer_alloc(size_t flow_capacity, time_t flow_
 	balancer->flow_heap = os_memory_alloc(flow_capacity, sizeof(struct flow));
 	balancer->flow_backends = os_memory_alloc(flow_capacity, sizeof(device_t));
 	balancer->backend_pool = index_pool_alloc(backend_capacity, backend_expiration_time);
+	balancer->backend_timers = timer_wheel_alloc(backend_capacity, BACKEND_TIMERS_GRANULARITY);
+	balancer->backend_expiration_time = backend_expiration_time;
 	balancer->cht = cht_alloc(cht_height, backend_capacity);
 	return balancer;
 }
@@ -79,4 +91,22 @@ static inline bool balancer_get_backend(struct balancer* balancer, struct flow*
 	return true;
 }
 
-static inline void balancer_process_heartbeat(struct balancer* balancer, device_t backend, time_t time) { index_pool_refresh(balancer->backend_pool, time, backend); }
+static inline void balancer_process_heartbeat(struct balancer* balancer, device_t backend, time_t time)
+{
+	// A backend that starts changes the preferred backend of some CHT buckets
+	if (!index_pool_used(balancer->backend_pool, time, backend)) {
+		cht_request_rebuild(balancer->cht);
+	}
+	index_pool_refresh(balancer->backend_pool, time, backend);
+	timer_wheel_schedule(balancer->backend_timers, backend, time + balancer->backend_expiration_time);
+}
+
+// Notices stopped backends and keeps the CHT's preferred backends up to date, so that assigning new flows to backends is O(1)
+static inline void balancer_maintain(struct balancer* balancer, time_t time)
+{
+	size_t backend;
+	if (timer_wheel_pop_expired(balancer->backend_timers, time, &backend)) {
+		cht_request_rebuild(balancer->cht);
+	}
+	cht_rebuild(balancer->cht, balancer->backend_pool, time, CHT_REBUILD_BUCKETS_PER_PACKET);
+}
@@ -2,6 +2,7 @@
 #include "net/skeleton.h"
 #include "os/config.h"
 #include "os/log.h"
+#include "os/stats.h"
 #include "os/time.h"
 
 // Note: We assume the packets to route always arrive on the last device
@@ -44,9 +45,12 @@ void nf_handle(struct net_packet* packet)
 	struct net_tcpudp_header* tcpudp_header;
 	if (!net_get_ether_header(packet, &ether_header) || !net_get_ipv4_header(ether_header, &ipv4_header) || !net_get_tcpudp_header(ipv4_header, &tcpudp_header)) {
 		os_debug("Not TCP/UDP over IPv4 over Ethernet");
+		os_stats_drop(OS_STATS_DROP_UNSUPPORTED);
 		return;
 	}
 
+	balancer_maintain(balancer, packet->time);
+
 	if (packet->device < devices_count - 1) {
 		balancer_process_heartbeat(balancer, packet->device, packet->time);
 		return;
@@ -57,5 +61,8 @@ void nf_handle(struct net_packet* packet)
 	device_t backend;
 	if (balancer_get_backend(balancer, &flow, packet->time, &backend)) {
 		net_transmit(packet, backend, 0);
+	} else {
+		os_debug("No available backend");
+		os_stats_drop(OS_STATS_DROP_NO_DESTINATION);
 	}
 }
@@ -2,6 +2,7 @@
 #include "net/skeleton.h"
 #include "os/config.h"
 #include "os/log.h"
+#include "os/stats.h"
 #include "os/time.h"
 
 static uint32_t external_addr;
@@ -33,6 +34,7 @@ void nf_handle(struct net_packet* packet)
 	struct net_tcpudp_header* tcpudp_header;
 	if (!net_get_ether_header(packet, &ether_header) || !net_get_ipv4_header(ether_header, &ipv4_header) || !net_get_tcpudp_header(ipv4_header, &tcpudp_header)) {
 		os_debug("Not TCP/UDP over IPv4 over Ethernet");
+		os_stats_drop(OS_STATS_DROP_UNSUPPORTED);
 		return;
 	}
 
@@ -41,6 +43,7 @@ void nf_handle(struct net_packet* packet)
 		if (flow_table_get_external(table, packet->time, tcpudp_header->dst_port, &internal_flow)) {
 			if ((internal_flow.dst_ip != ipv4_header->src_addr) || (internal_flow.dst_port != tcpudp_header->src_port) || (internal_flow.protocol != ipv4_header->next_proto_id)) {
 				os_debug("Spoofing attempt");
+				os_stats_drop(OS_STATS_DROP_SPOOFING);
 				return;
 			}
 
@@ -50,6 +53,7 @@ void nf_handle(struct net_packet* packet)
 			tcpudp_header->dst_port = internal_flow.src_port;
 		} else {
 			os_debug("Unknown flow");
+			os_stats_drop(OS_STATS_DROP_UNKNOWN_FLOW);
 			return;
 		}
 	} else {
@@ -64,6 +68,7 @@ void nf_handle(struct net_packet* packet)
 		uint16_t external_port;
 		if (!flow_table_get_internal(table, packet->time, &flow, &external_port)) {
 			os_debug("No space for the flow");
+			os_stats_drop(OS_STATS_DROP_NO_SPACE);
 			return;
 		}
 
@@ -3,6 +3,9 @@
 static device_t wan_device;
 static device_t lan_device;
 
+// No state other than the config, thus each core can have its own copy
+const bool nf_per_flow_state = true;
+
 bool nf_init(device_t devices_count)
 {
 	return os_config_get_device("wan device", devices_count, &wan_device) && os_config_get_device("lan device", devices_count, &lan_device) && lan_device != wan_device;
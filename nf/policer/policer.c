@@ -1,6 +1,7 @@
 #include "net/skeleton.h"
 #include "os/config.h"
 #include "os/memory.h"
+#include "os/stats.h"
 #include "os/time.h"
 #include "structs/index_pool.h"
 #include "structs/map.h"
@@ -47,6 +48,7 @@ void nf_handle(struct net_packet* packet)
 	struct net_ipv4_header* ipv4_header;
 
 	if (!net_get_ether_header(packet, &ether_header) || !net_get_ipv4_header(ether_header, &ipv4_header)) {
+		os_stats_drop(OS_STATS_DROP_UNSUPPORTED);
 		return;
 	}
 
@@ -69,11 +71,13 @@ void nf_handle(struct net_packet* packet)
 				buckets[index].size -= packet->length;
 			} else {
 				// Packet too big
+				os_stats_drop(OS_STATS_DROP_RATE_LIMIT);
 				return;
 			}
 		} else {
 			if (packet->length > burst) {
 				// Unknown flow, length greater than burst
+				os_stats_drop(OS_STATS_DROP_RATE_LIMIT);
 				return;
 			}
 
@@ -89,6 +93,7 @@ void nf_handle(struct net_packet* packet)
 				buckets[index].time = packet->time;
 			} else {
 				// No more space
+				os_stats_drop(OS_STATS_DROP_NO_SPACE);
 				return;
 			}
 		}
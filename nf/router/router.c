@@ -1,6 +1,7 @@
 #include "net/skeleton.h"
 #include "os/config.h"
 #include "os/log.h"
+#include "os/stats.h"
 #include "structs/lpm.h"
 
 static device_t devices_count;
@@ -36,36 +37,45 @@ void nf_handle(struct net_packet* packet)
 	struct net_ipv4_header* ipv4_header;
 	if (!net_get_ether_header(packet, &ether_header) || !net_get_ipv4_header(ether_header, &ipv4_header)) {
 		os_debug("Not IPv4 over Ethernet");
+		os_stats_drop(OS_STATS_DROP_UNSUPPORTED);
 		return;
 	}
 
 	if ((ipv4_header->version_ihl >> 4) != 4u) {
 		os_debug("Not IPv4");
+		os_stats_drop(OS_STATS_DROP_UNSUPPORTED);
 		return;
 	}
 
 	if ((ipv4_header->version_ihl & 0xF) < 5u) { // ihl is in units of 4 bytes
 		os_debug("IPv4 header too short");
+		os_stats_drop(OS_STATS_DROP_MALFORMED);
 		return;
 	}
 
 	if (ipv4_header->total_length < ((ipv4_header->version_ihl & 0xF) * 4u)) {
 		os_debug("Total length too short");
+		os_stats_drop(OS_STATS_DROP_MALFORMED);
 		return;
 	}
 
 	if (!net_ipv4_checksum_valid(ipv4_header)) {
 		os_debug("Bad packet checksum");
+		os_stats_drop(OS_STATS_DROP_MALFORMED);
 		return;
 	}
 
 	if (ipv4_header->time_to_live == 0u) {
 		os_debug("Packet lifetime is over");
+		os_stats_drop(OS_STATS_DROP_EXPIRED);
 		return;
 	}
 
 	device_t dst_device;
 	if (lpm_search(lpm, &(ipv4_header->dst_addr), &dst_device)) {
 		net_transmit(packet, dst_device, UPDATE_ETHER_ADDRS);
+	} else {
+		os_debug("No route");
+		os_stats_drop(OS_STATS_DROP_NO_DESTINATION);
 	}
 }
@@ -8,6 +8,7 @@ import shutil
 
 from klint import statistics
 import klint.executor as nf_executor
+import klint.externals.structs.map as map_contracts
 import klint.verif.persistence as verif_persist
 import klint.verif.executor as verif_executor
 
@@ -61,6 +62,7 @@ def main():
     parser = argparse.ArgumentParser()
     parser.add_argument('--use-cached-symbex', action='store_true', help='Verify only, using cached symbolic execution results')
     parser.add_argument('--export-graphs', action='store_true', help='Dump the state graphs resulting from each iteration of symbolic execution')
+    parser.add_argument('--map-inline-keys', action='store_true', help='Use the map contracts for maps that copy keys, i.e., the environment built with STRUCTS_MAP=inline')
 
     subparsers = parser.add_subparsers(dest='command', required=True)
 
@@ -76,6 +78,8 @@ def main():
 
     args = parser.parse_args()
 
+    map_contracts.INLINE_KEYS = args.map_inline_keys
+
     global graph_counter
     if args.export_graphs:
         graph_counter = 0
@@ -16,13 +16,16 @@ import klint.externals.net.packet
 import klint.externals.net.tx
 import klint.externals.os.clock
 import klint.externals.os.config
+import klint.externals.os.init
 import klint.externals.os.log
 import klint.externals.os.memory
 import klint.externals.os.pci
+import klint.externals.os.stats
 import klint.externals.structs.cht
 import klint.externals.structs.index_pool
 import klint.externals.structs.lpm
 import klint.externals.structs.map
+import klint.externals.structs.timer_wheel
 import klint.externals.verif.verif
 import klint.fullstack
 import klint.ghostmaps
@@ -34,10 +37,12 @@ structs_alloc_externals = {
     'index_pool_alloc': klint.externals.structs.index_pool.index_pool_alloc,
     'cht_alloc': klint.externals.structs.cht.ChtAlloc,
     'lpm_alloc': klint.externals.structs.lpm.LpmAlloc,
+    'timer_wheel_alloc': klint.externals.structs.timer_wheel.timer_wheel_alloc,
 }
 
 structs_functions_externals = {
     'map_get': klint.externals.structs.map.map_get,
+    'map_get_batch': klint.externals.structs.map.map_get_batch,
     'map_set': klint.externals.structs.map.map_set,
     'map_remove': klint.externals.structs.map.map_remove,
     'index_pool_borrow': klint.externals.structs.index_pool.index_pool_borrow,
@@ -45,9 +50,14 @@ structs_functions_externals = {
     'index_pool_refresh': klint.externals.structs.index_pool.index_pool_refresh,
     'index_pool_used': klint.externals.structs.index_pool.index_pool_used,
     'cht_find_preferred_available_backend': klint.externals.structs.cht.ChtFindPreferredAvailableBackend,
+    'cht_request_rebuild': klint.externals.structs.cht.ChtRequestRebuild,
+    'cht_rebuild': klint.externals.structs.cht.ChtRebuild,
     'lpm_set': klint.externals.structs.lpm.LpmSet,
     'lpm_search': klint.externals.structs.lpm.LpmSearch,
     'lpm_remove': klint.externals.structs.lpm.LpmRemove,
+    'timer_wheel_schedule': klint.externals.structs.timer_wheel.timer_wheel_schedule,
+    'timer_wheel_cancel': klint.externals.structs.timer_wheel.timer_wheel_cancel,
+    'timer_wheel_pop_expired': klint.externals.structs.timer_wheel.timer_wheel_pop_expired,
 }
 
 
@@ -87,12 +97,16 @@ def find_fixedpoint_states(
 
 libnf_init_externals = {
     'os_config_try_get': klint.externals.os.config.os_config_try_get,
-    'os_memory_alloc': klint.externals.os.memory.os_memory_alloc
+    'os_memory_alloc': klint.externals.os.memory.os_memory_alloc,
+    'os_memory_scratch_begin': klint.externals.os.memory.os_memory_scratch_begin,
+    'os_memory_scratch_alloc': klint.externals.os.memory.os_memory_scratch_alloc,
+    'os_memory_scratch_end': klint.externals.os.memory.os_memory_scratch_end
 }
 libnf_init_externals.update(structs_alloc_externals)
 
 libnf_handle_externals = {
     'os_debug': klint.externals.os.log.os_debug,
+    'os_stats_drop': klint.externals.os.stats.os_stats_drop,
     'net_transmit': klint.externals.net.tx.net_transmit,
     'net_flood': klint.externals.net.tx.net_flood,
     'net_flood_except': klint.externals.net.tx.net_flood_except
@@ -137,17 +151,29 @@ def execute_libnf(
 nf_init_externals = {
     'os_clock_sleep_ns': klint.externals.os.clock.os_clock_sleep_ns,
     'os_config_try_get': klint.externals.os.config.os_config_try_get,
+    'os_init_cores': klint.externals.os.init.os_init_cores,
     'os_memory_alloc': klint.externals.os.memory.os_memory_alloc,
+    'os_memory_scratch_begin': klint.externals.os.memory.os_memory_scratch_begin,
+    'os_memory_scratch_alloc': klint.externals.os.memory.os_memory_scratch_alloc,
+    'os_memory_scratch_end': klint.externals.os.memory.os_memory_scratch_end,
     'os_memory_phys_to_virt': klint.externals.os.memory.os_memory_phys_to_virt,
     'os_memory_virt_to_phys': klint.externals.os.memory.os_memory_virt_to_phys,
     'os_pci_enumerate': klint.externals.os.pci.os_pci_enumerate,
+    'os_stats_memory': klint.externals.os.stats.os_stats_memory,
     'descriptor_ring_alloc': klint.externals.verif.verif.descriptor_ring_alloc,
+    'packet_buffers_alloc': klint.externals.verif.verif.packet_buffers_alloc,
     'agents_alloc': klint.externals.verif.verif.agents_alloc,
     'foreach_index_forever': klint.externals.verif.verif.foreach_index_forever
 }
 nf_init_externals.update(structs_alloc_externals)
 
-nf_handle_externals = structs_functions_externals
+nf_handle_externals = {
+    'os_stats_drop': klint.externals.os.stats.os_stats_drop,
+    'os_stats_rx': klint.externals.os.stats.os_stats_rx,
+    'os_stats_tx': klint.externals.os.stats.os_stats_tx,
+    'os_stats_latency': klint.externals.os.stats.os_stats_latency
+}
+nf_handle_externals.update(structs_functions_externals)
 
 nf_inited_states = []  # "global" for use in externals/verif/verif.py
 
@@ -1,11 +1,19 @@
 import angr
 from angr.sim_type import *
 import claripy
+from collections import namedtuple
 
 from kalm import utils
 import klint.fullstack.device as nf_device
 
 
+# predicate os_memory_scratch_scope(list<pair<void*, size_t> > allocs);
+# (with 'active' to know whether there is a scope at all, since metadata cannot be removed)
+ScratchScope = namedtuple("scratchscope", ["active", "allocs"])
+
+def scratch_scope(state):
+    return state.metadata.get(ScratchScope, None, default_init=lambda: ScratchScope(False, ()))
+
 # void* os_memory_alloc(size_t count, size_t size);
 # requires count == 1 || count * size <= SIZE_MAX;
 # ensures uchars(result, count * size, ?cs) &*& true == all_eq(cs, 0) &*& result + count * size <= (char*) UINTPTR_MAX &*&
@@ -16,6 +24,11 @@ class os_memory_alloc(angr.SimProcedure):
         self.prototype = SimTypeFunction([SimTypeLength(False), SimTypeLength(False)], SimTypePointer(SimTypeBottom(label="void")), arg_names=["count", "size"])
 
     def run(self, count, size):
+        # Not part of the contract, but all allocations within a scratch scope may be released at its end on some OSes
+        assert not scratch_scope(self.state).active, "os_memory_alloc cannot be called within a scratch scope"
+        return self.allocate(count, size)
+
+    def allocate(self, count, size):
         # Symbolism assumptions
         if size.symbolic:
             raise Exception("size cannot be symbolic")
@@ -35,6 +48,49 @@ class os_memory_alloc(angr.SimProcedure):
         print("!!! os_memory_alloc", count, size, "->", result)
         return result
 
+# void os_memory_scratch_begin(void);
+# requires emp;
+# ensures os_memory_scratch_scope(nil);
+class os_memory_scratch_begin(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([], None)
+
+    def run(self):
+        # Not part of the contract, but checked at runtime
+        assert not scratch_scope(self.state).active, "Scratch scopes cannot be nested"
+        self.state.metadata.append(None, ScratchScope(True, ()))
+
+# void* os_memory_scratch_alloc(size_t count, size_t size);
+# requires os_memory_scratch_scope(?allocs) &*& count * size <= SIZE_MAX;
+# ensures os_memory_scratch_scope(cons(pair(result, count * size), allocs)) &*& (same as os_memory_alloc)
+class os_memory_scratch_alloc(os_memory_alloc):
+    def run(self, count, size):
+        scope = scratch_scope(self.state)
+        assert scope.active, "Scratch memory can only be used within a scope"
+        result = self.allocate(count, size)
+        self.state.metadata.append(None, ScratchScope(True, scope.allocs + (result,)))
+        return result
+
+# void os_memory_scratch_end(void);
+# requires os_memory_scratch_scope(?allocs) &*& os_memory_scratch_chars(allocs);
+# ensures emp;
+class os_memory_scratch_end(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([], None)
+
+    def run(self):
+        scope = scratch_scope(self.state)
+        assert scope.active, "Scratch memory can only be used within a scope"
+        # Release the memory by replacing its fractions with zero ones, so that any later access fails
+        for addr in scope.allocs:
+            meta = self.state.metadata.get(self.state.heap.Metadata, addr)
+            fractions = self.state.maps.new_array(self.state.sizes.ptr, 8, meta.count, "scratch_released" + self.state.heap.FRACS_NAME)
+            self.state.solver.add(self.state.maps.forall(fractions, lambda k, v: v == 0))
+            self.state.metadata.append(addr, meta._replace(fractions=fractions))
+        self.state.metadata.append(None, ScratchScope(False, ()))
+
 # void* os_memory_phys_to_virt(uintptr_t addr, size_t size);
 class os_memory_phys_to_virt(angr.SimProcedure):
     def __init__(self, *args, **kwargs):
@@ -0,0 +1,49 @@
+import angr
+from angr.sim_type import *
+
+# Statistics are write-only from the NF's point of view and have no effect on packets, thus they are modelled as doing nothing.
+
+# void os_stats_drop(enum os_stats_drop_reason reason);
+class os_stats_drop(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypeInt(False)], None, arg_names=["reason"])
+
+    def run(self, reason):
+        pass
+
+# void os_stats_rx(size_t device, size_t count);
+class os_stats_rx(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypeLength(False), SimTypeLength(False)], None, arg_names=["device", "count"])
+
+    def run(self, device, count):
+        pass
+
+# void os_stats_tx(size_t device, size_t count);
+class os_stats_tx(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypeLength(False), SimTypeLength(False)], None, arg_names=["device", "count"])
+
+    def run(self, device, count):
+        pass
+
+# void os_stats_latency(uint64_t cycles, size_t count);
+class os_stats_latency(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypeNum(64, False), SimTypeLength(False)], None, arg_names=["cycles", "count"])
+
+    def run(self, cycles, count):
+        pass
+
+# void os_stats_memory(void);
+class os_stats_memory(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([], None)
+
+    def run(self):
+        pass
@@ -64,3 +64,41 @@ class ChtFindPreferredAvailableBackend(angr.SimProcedure):
 
         guard = self.state.maps.forall(active_backends.items, lambda k, v: claripy.Or(k < 0, k >= cht.backend_capacity.zero_extend(self.state.sizes.size_t - self.state.sizes.uint16_t)))
         return utils.fork_guarded(self, self.state, guard, case_true, case_false)
+
+
+# void cht_request_rebuild(struct cht* cht);
+# Only changes the cht's cached preferred backends, which the cht contracts do not expose
+class ChtRequestRebuild(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypePointer(SimTypeBottom(label="void"))], None, arg_names=["cht"])
+
+    def run(self, cht):
+        print(f"!!! cht_request_rebuild [cht: {cht}]")
+
+        # Preconditions
+        self.state.metadata.get(Cht, cht)
+
+
+# bool cht_rebuild(struct cht* cht, struct index_pool* active_backends, time_t time, uint16_t max_buckets);
+# Same as cht_request_rebuild, the result is all there is
+class ChtRebuild(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction(
+            [SimTypePointer(SimTypeBottom(label="void")), SimTypePointer(SimTypeBottom(label="void")), SimTypeNum(64, False), SimTypeNum(16, False)],
+            SimTypeBool(),
+            arg_names=["cht", "active_backends", "time", "max_buckets"])
+
+    def run(self, cht, active_backends, time, max_buckets):
+        print(f"!!! cht_rebuild [active_backends: {active_backends}, max_buckets: {max_buckets}]")
+
+        # Preconditions
+        cht = self.state.metadata.get(Cht, cht)
+        active_backends = self.state.metadata.get(Pool, active_backends)
+        assert utils.definitely_true(self.state.solver,
+            cht.backend_capacity.zero_extend(self.state.sizes.size_t - self.state.sizes.uint16_t) <= active_backends.size
+        )
+
+        # Postconditions
+        return claripy.BVS("cht_rebuilt", self.state.sizes.bool)
@@ -60,7 +60,12 @@ class LpmSet(angr.SimProcedure):
             return claripy.BVV(1, state.sizes.bool)
         def case_false(state):
             return claripy.BVV(0, state.sizes.bool)
-        return utils.fork_guarded(self, self.state, self.state.maps.get(lpmp.table, key.concat(width))[1] | (self.state.maps.length(lpmp.table) < lpmp.capacity), case_true, case_false)
+        has_space = self.state.maps.length(lpmp.table) < lpmp.capacity
+        if utils.definitely_true(self.state.solver, lpmp.key_size == 4):
+            # The DIR-24-8 implementation for 4-byte keys can also run out of second-level tables for prefixes longer than 24 bits
+            tables_full = claripy.BoolS("lpm_tables_full")
+            has_space = has_space & ~(tables_full & width.UGT(24))
+        return utils.fork_guarded(self, self.state, self.state.maps.get(lpmp.table, key.concat(width))[1] | has_space, case_true, case_false)
 
 # bool lpm_search(struct lpm* lpm, void* key, void* out_value);
 class LpmSearch(angr.SimProcedure):
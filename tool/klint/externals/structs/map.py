@@ -9,9 +9,15 @@ from kalm import utils
 # predicate mapp(struct map* map, size_t key_size, size_t capacity, list<pair<list<char>, size_t> > values, list<pair<list<char>, void*> > addrs);
 Map = namedtuple('mapp', ['key_size', 'capacity', 'values', 'addrs'])
 
+# Whether the map copies keys into itself (STRUCTS_MAP=inline) instead of keeping a pointer to them, see map.h;
+# if so, the map holds no ownership of keys, 'addrs' stays empty, and keys must be at most INLINE_KEY_SIZE_MAX bytes
+INLINE_KEYS = False
+INLINE_KEY_SIZE_MAX = 16
+
 # struct map* map_alloc(size_t key_size, size_t capacity);
 # requires capacity * 64 <= SIZE_MAX;
 # ensures mapp(result, key_size, capacity, nil, nil);
+# With inline keys, additionally requires key_size <= INLINE_KEY_SIZE_MAX
 class map_alloc(angr.SimProcedure):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
@@ -26,6 +32,8 @@ class map_alloc(angr.SimProcedure):
         assert utils.definitely_true(self.state.solver,
             ((capacity * 64).ULE(2 ** self.state.sizes.size_t - 1))
         )
+        if INLINE_KEYS:
+            assert utils.definitely_true(self.state.solver, key_size.ULE(INLINE_KEY_SIZE_MAX))
 
         # Postconditions
         result = claripy.BVS("map", self.state.sizes.ptr)
@@ -71,6 +79,51 @@ class map_get(angr.SimProcedure):
             return claripy.BVV(0, state.sizes.bool)
         return utils.fork_guarded_has(self, self.state, mapp.values, key, case_has, case_not)
 
+# void map_get_batch(struct map* map, void** keys, size_t count, size_t* out_values, bool* out_found);
+# requires mapp(map, ?key_size, ?capacity, ?values, ?addrs) &*&
+#          keys[0..count] |-> ?key_ptrs &*&
+#          keys_chars(key_ptrs, key_size, ?key_list) &*&
+#          out_values[0..count] |-> _ &*&
+#          out_found[0..count] |-> _;
+# ensures mapp(map, key_size, capacity, values, addrs) &*&
+#         keys[0..count] |-> key_ptrs &*&
+#         keys_chars(key_ptrs, key_size, key_list) &*&
+#         out_values[0..count] |-> ?values_list &*&
+#         out_found[0..count] |-> ?found_list &*&
+#         true == map_batch_results(values, key_list, values_list, found_list);
+class map_get_batch(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypePointer(SimTypeBottom(label="void")), SimTypePointer(SimTypePointer(SimTypeBottom(label="void"))), SimTypeLength(False), SimTypePointer(SimTypeLength(False)), SimTypePointer(SimTypeBool())], None, arg_names=["map", "keys", "count", "out_values", "out_found"])
+
+    def run(self, map, keys, count, out_values, out_found):
+        print("!!! map_get_batch", map, keys, count, out_values, out_found)
+
+        # Symbolism assumptions
+        if count.symbolic:
+            raise Exception("count cannot be symbolic")
+        count = self.state.solver.eval_one(count)
+
+        # Preconditions
+        mapp = self.state.metadata.get(Map, map)
+        ptr_bytes = self.state.sizes.ptr // 8
+        bool_bytes = self.state.sizes.bool // 8
+        key_list = []
+        for n in range(count):
+            key_ptr = self.state.memory.load(keys + n * ptr_bytes, ptr_bytes, endness=self.state.arch.memory_endness)
+            # key_ptr != NULL implicit due to the way the heap works; there can never be something at NULL
+            key_list.append(self.state.memory.load(key_ptr, mapp.key_size, endness=self.state.arch.memory_endness))
+            self.state.memory.load(out_values + n * ptr_bytes, ptr_bytes)
+            self.state.memory.load(out_found + n * bool_bytes, bool_bytes)
+        print("!!! map_get_batch keys", key_list)
+
+        # Postconditions
+        # No need to fork here, unlike map_get, since the result of each lookup is data that the caller will branch on if needed
+        for (n, key) in enumerate(key_list):
+            (value, has) = self.state.maps.get(mapp.values, key)
+            self.state.memory.store(out_values + n * ptr_bytes, value, endness=self.state.arch.memory_endness)
+            self.state.memory.store(out_found + n * bool_bytes, claripy.If(has, claripy.BVV(1, self.state.sizes.bool), claripy.BVV(0, self.state.sizes.bool)), endness=self.state.arch.memory_endness)
+
 # void map_set(struct map* map, void* key_ptr, size_t value);
 # requires mapp(map, ?key_size, ?capacity, ?values, ?addrs) &*&
 #          key_ptr != NULL &*&
@@ -79,6 +132,14 @@ class map_get(angr.SimProcedure):
 #          ghostmap_get(values, key) == none &*&
 #          ghostmap_get(addrs, key) == none;
 # ensures mapp(map, key_size, capacity, ghostmap_set(values, key, value), ghostmap_set(addrs, key, key_ptr));
+# With inline keys, the key is copied, so the map takes no ownership of it:
+# requires mapp(map, ?key_size, ?capacity, ?values, nil) &*&
+#          key_ptr != NULL &*&
+#          [?frac]chars(key_ptr, key_size, ?key) &*&
+#          length(values) < capacity &*&
+#          ghostmap_get(values, key) == none;
+# ensures mapp(map, key_size, capacity, ghostmap_set(values, key, value), nil) &*&
+#         [frac]chars(key_ptr, key_size, key);
 class map_set(angr.SimProcedure):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
@@ -91,6 +152,15 @@ class map_set(angr.SimProcedure):
         mapp = self.state.metadata.get(Map, map)
         # key_ptr != NULL implicit due to the way the heap works; there can never be something at NULL
         key = self.state.memory.load(key_ptr, mapp.key_size, endness=self.state.arch.memory_endness)
+        if INLINE_KEYS:
+            assert utils.definitely_true(self.state.solver, claripy.And(
+                self.state.maps.length(mapp.values) < mapp.capacity,
+                claripy.Not(self.state.maps.get(mapp.values, key)[1])
+            ))
+            print("!!! map_set key", key)
+            self.state.maps.set(mapp.values, key, value)
+            return
+
         self.state.heap.take(25, key_ptr)
         assert utils.definitely_true(self.state.solver, claripy.And(
             self.state.maps.length(mapp.values) < mapp.capacity,
@@ -112,6 +182,13 @@ class map_set(angr.SimProcedure):
 #          ghostmap_get(addrs, key) == some(key_ptr);
 # ensures mapp(map, key_size, capacity, ghostmap_remove(values, key), ghostmap_remove(addrs, key)) &*&
 #         [frac + 0.25]chars(key_ptr, key_size, key);
+# With inline keys, any copy of the key can be used to remove it, and no ownership is returned:
+# requires mapp(map, ?key_size, ?capacity, ?values, nil) &*&
+#          key_ptr != NULL &*&
+#          [?frac]chars(key_ptr, key_size, ?key) &*&
+#          ghostmap_get(values, key) != none;
+# ensures mapp(map, key_size, capacity, ghostmap_remove(values, key), nil) &*&
+#         [frac]chars(key_ptr, key_size, key);
 class map_remove(angr.SimProcedure):
     def __init__(self, *args, **kwargs):
         super().__init__(*args, **kwargs)
@@ -124,6 +201,12 @@ class map_remove(angr.SimProcedure):
         mapp = self.state.metadata.get(Map, map)
         # key_ptr != NULL implicit due to the way the heap works; there can never be something at NULL
         key = self.state.memory.load(key_ptr, mapp.key_size, endness=self.state.arch.memory_endness)
+        if INLINE_KEYS:
+            assert utils.definitely_true(self.state.solver, self.state.maps.get(mapp.values, key)[1])
+            print("!!! map_remove key", key)
+            self.state.maps.remove(mapp.values, key)
+            return
+
         frac = self.state.heap.take(None, key_ptr)
         assert utils.definitely_true(self.state.solver, claripy.And(
             frac != 0,
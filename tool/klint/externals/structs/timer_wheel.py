@@ -0,0 +1,119 @@
+import angr
+from angr.sim_type import *
+import claripy
+from collections import namedtuple
+
+from kalm import utils
+
+
+# predicate wheelp(struct timer_wheel* wheel, size_t capacity, time_t granularity, list<pair<size_t, time_t> > timers);
+Wheel = namedtuple('wheelp', ['capacity', 'granularity', 'timers'])
+
+# struct timer_wheel* timer_wheel_alloc(size_t capacity, time_t granularity);
+# requires capacity * sizeof(time_t) <= SIZE_MAX &*&
+#          granularity != 0;
+# ensures wheelp(result, capacity, granularity, nil);
+class timer_wheel_alloc(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypeLength(False), SimTypeNum(64, False)], SimTypePointer(SimTypeBottom(label="void")), arg_names=["capacity", "granularity"])
+
+    def run(self, capacity, granularity):
+        # Preconditions
+        assert utils.definitely_true(self.state.solver, claripy.And(
+            (capacity * self.state.sizes.uint64_t).ULE(2 ** self.state.sizes.size_t - 1),
+            granularity != 0
+        ))
+
+        # Postconditions
+        result = claripy.BVS("timer_wheel", self.state.sizes.ptr)
+        timers = self.state.maps.new(self.state.sizes.size_t, self.state.sizes.uint64_t, "wheel_timers")
+        self.state.metadata.append(result, Wheel(capacity, granularity, timers))
+        print("!!! timer_wheel_alloc", capacity, granularity, "->", result)
+        return result
+
+# void timer_wheel_schedule(struct timer_wheel* wheel, size_t index, time_t expiration_time);
+# requires wheelp(wheel, ?capacity, ?granularity, ?timers) &*&
+#          index < capacity;
+# ensures wheelp(wheel, capacity, granularity, ghostmap_set(timers, index, expiration_time));
+class timer_wheel_schedule(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypePointer(SimTypeBottom(label="void")), SimTypeLength(False), SimTypeNum(64, False)], None, arg_names=["wheel", "index", "expiration_time"])
+
+    def run(self, wheel, index, expiration_time):
+        print("!!! timer_wheel_schedule", wheel, index, expiration_time)
+
+        # Preconditions
+        wheelp = self.state.metadata.get(Wheel, wheel)
+        assert utils.definitely_true(self.state.solver,
+            index < wheelp.capacity
+        )
+
+        # Postconditions
+        self.state.maps.set(wheelp.timers, index, expiration_time)
+
+# void timer_wheel_cancel(struct timer_wheel* wheel, size_t index);
+# requires wheelp(wheel, ?capacity, ?granularity, ?timers) &*&
+#          index < capacity;
+# ensures wheelp(wheel, capacity, granularity, ghostmap_remove(timers, index));
+class timer_wheel_cancel(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypePointer(SimTypeBottom(label="void")), SimTypeLength(False)], None, arg_names=["wheel", "index"])
+
+    def run(self, wheel, index):
+        print("!!! timer_wheel_cancel", wheel, index)
+
+        # Preconditions
+        wheelp = self.state.metadata.get(Wheel, wheel)
+        assert utils.definitely_true(self.state.solver,
+            index < wheelp.capacity
+        )
+
+        # Postconditions
+        self.state.maps.remove(wheelp.timers, index)
+
+# bool timer_wheel_pop_expired(struct timer_wheel* wheel, time_t time, size_t* out_index);
+# requires wheelp(wheel, ?capacity, ?granularity, ?timers) &*&
+#          *out_index |-> _;
+# ensures result ? (*out_index |-> ?index &*&
+#                   index < capacity &*&
+#                   ghostmap_get(timers, index) == some(?expiration_time) &*&
+#                   expiration_time < time &*&
+#                   wheelp(wheel, capacity, granularity, ghostmap_remove(timers, index)))
+#                : (*out_index |-> _ &*&
+#                   wheelp(wheel, capacity, granularity, timers));
+# (the contract does not say when the result is false, since that depends on the granularity and on whether time went backwards)
+class timer_wheel_pop_expired(angr.SimProcedure):
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        self.prototype = SimTypeFunction([SimTypePointer(SimTypeBottom(label="void")), SimTypeNum(64, False), SimTypePointer(SimTypeLength(False))], SimTypeBool(), arg_names=["wheel", "time", "out_index"])
+
+    def run(self, wheel, time, out_index):
+        print("!!! timer_wheel_pop_expired", wheel, time, out_index)
+
+        # Preconditions
+        wheelp = self.state.metadata.get(Wheel, wheel)
+        self.state.memory.load(out_index, self.state.sizes.size_t // 8)
+
+        # Postconditions
+        result = claripy.BVS("wheel_popped", self.state.sizes.bool)
+        def case_true(state):
+            print("!!! timer_wheel_pop_expired true")
+            index = claripy.BVS("wheel_index", state.sizes.size_t)
+            (expiration_time, present) = state.maps.get(wheelp.timers, index)
+            state.solver.add(
+                index.ULT(wheelp.capacity),
+                present,
+                expiration_time.ULT(time)
+            )
+            state.maps.remove(wheelp.timers, index)
+            state.memory.store(out_index, index, endness=state.arch.memory_endness)
+            return result
+
+        def case_false(state):
+            print("!!! timer_wheel_pop_expired false")
+            return result
+
+        return utils.fork_guarded(self, self.state, result != claripy.BVV(0, self.state.sizes.bool), case_true, case_false)
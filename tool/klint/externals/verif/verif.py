@@ -5,6 +5,7 @@ import claripy
 from kalm import utils
 from kalm import executor as binary_executor
 from klint import executor as nf_executor
+from klint.externals.os.memory import os_memory_alloc
 from klint.fullstack import device as nf_device
 
 
@@ -62,6 +63,15 @@ class descriptor_ring_alloc(angr.SimProcedure):
         self.state.memory.set_special_object(obj, concrete_count, (self.state.sizes.uint64_t * 2) // 8, ring_reader, ring_writer)
         return obj
 
+# void* packet_buffers_alloc(size_t count, size_t size);
+# Same as os_memory_alloc, plus alignment to the size
+class packet_buffers_alloc(os_memory_alloc):
+    def run(self, count, size):
+        result = super().run(count, size)
+        multiplier = claripy.BVS("packet_buffers_mult", self.state.sizes.ptr)
+        self.state.solver.add(result == multiplier * size)
+        return result
+
 # void* agents_alloc(size_t count, size_t size);
 class agents_alloc(angr.SimProcedure):
     def __init__(self, *args, **kwargs):
@@ -349,6 +349,66 @@ receive_init = {
     "Program FTQF" : {
         "action"   : Node(AST.Clear, [Node(AST.Reg, ["FTQF.Queue Enable"])]),
     },
+    # 4.6.10.1.1: "In RSS mode, the RSS key (RSSRK) and redirection
+    # table (RETA) should be programmed."
+    "Program RSSRK" : {
+        "action" : Node(AST.Write, [
+            Node(AST.Reg, ["RSSRK.K"]),
+            Node(AST.Value, [lambda bv: True])]),
+    },
+    "Program RETA Entry0" : {
+        "action" : Node(AST.Write, [
+            Node(AST.Reg, ["RETA.Entry0"]),
+            Node(AST.Value, [lambda bv: True])]),
+    },
+    "Program RETA Entry1" : {
+        "action" : Node(AST.Write, [
+            Node(AST.Reg, ["RETA.Entry1"]),
+            Node(AST.Value, [lambda bv: True])]),
+    },
+    "Program RETA Entry2" : {
+        "action" : Node(AST.Write, [
+            Node(AST.Reg, ["RETA.Entry2"]),
+            Node(AST.Value, [lambda bv: True])]),
+    },
+    "Program RETA Entry3" : {
+        "action" : Node(AST.Write, [
+            Node(AST.Reg, ["RETA.Entry3"]),
+            Node(AST.Value, [lambda bv: True])]),
+    },
+    # "Program RXPBSIZE, MRQC, [...] according to the DCB and
+    # virtualization modes" - with both off, MRQE is either RSS
+    # disabled or RSS only
+    "Program MRQC MRQE" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action" : Node(AST.Write, [
+            Node(AST.Reg, ["MRQC.MRQE"]),
+            Node(AST.Value, [lambda bv: (bv == 0) | (bv == 1)])]),
+    },
+    "Program MRQC TcpIPv4" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action"   : Node(AST.Set, [Node(AST.Reg, ["MRQC.TcpIPv4"])]),
+    },
+    "Program MRQC IPv4" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action"   : Node(AST.Set, [Node(AST.Reg, ["MRQC.IPv4"])]),
+    },
+    "Program MRQC IPv6" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action"   : Node(AST.Set, [Node(AST.Reg, ["MRQC.IPv6"])]),
+    },
+    "Program MRQC TcpIPv6" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action"   : Node(AST.Set, [Node(AST.Reg, ["MRQC.TcpIPv6"])]),
+    },
+    "Program MRQC UdpIPv4" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action"   : Node(AST.Set, [Node(AST.Reg, ["MRQC.UdpIPv4"])]),
+    },
+    "Program MRQC UdpIPv6" : {
+        "precond"  : Node(AST.Not, [Node(AST.Reg, ["RXCTRL.RXEN"])]),
+        "action"   : Node(AST.Set, [Node(AST.Reg, ["MRQC.UdpIPv6"])]),
+    },
     "Program RDRXCTL I" : {
         "action"   : Node(AST.Set, [Node(AST.Reg, ["RDRXCTL.CRCStrip"])]),
     },
@@ -516,6 +516,84 @@ registers = {
             },
         }
     },
+    # 8.2.3.7.12
+    'MRQC' : {
+        'addr'   : [(0x0EC80, 0, 0)],
+        'length' : 32,
+        'access' : Access.RW,
+        'fields' : {
+            'MRQE' : {
+                'init'   : 0x0,
+                'start'  : 0,
+                'end'    : 3
+            },
+            'TcpIPv4' : {
+                'init'   : 0b0,
+                'start'  : 16,
+            },
+            'IPv4' : {
+                'init'   : 0b0,
+                'start'  : 17,
+            },
+            'IPv6' : {
+                'init'   : 0b0,
+                'start'  : 20,
+            },
+            'TcpIPv6' : {
+                'init'   : 0b0,
+                'start'  : 21,
+            },
+            'UdpIPv4' : {
+                'init'   : 0b0,
+                'start'  : 22,
+            },
+            'UdpIPv6' : {
+                'init'   : 0b0,
+                'start'  : 23,
+            },
+        }
+    },
+    # 8.2.3.7.15
+    'RETA' : {
+        'addr'   : [(0x0EB00, 4, 31)],
+        'length' : 32,
+        'access' : Access.RW,
+        'fields' : {
+            'Entry0' : {
+                'init'   : 'X',
+                'start'  : 0,
+                'end'    : 3
+            },
+            'Entry1' : {
+                'init'   : 'X',
+                'start'  : 8,
+                'end'    : 11
+            },
+            'Entry2' : {
+                'init'   : 'X',
+                'start'  : 16,
+                'end'    : 19
+            },
+            'Entry3' : {
+                'init'   : 'X',
+                'start'  : 24,
+                'end'    : 27
+            },
+        }
+    },
+    # 8.2.3.7.16
+    'RSSRK' : {
+        'addr'   : [(0x0EB80, 4, 9)],
+        'length' : 32,
+        'access' : Access.RW,
+        'fields' : {
+            'K' : {
+                'init'   : 'X',
+                'start'  : 0,
+                'end'    : 31
+            },
+        }
+    },
     # 8.2.3.10.2
     'RTTDCS' : {
         'addr'   : [(0x04900, 0, 0)],  # base, multiplier, id limit